@@ -4,6 +4,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define str(x) __str(x)
 #define __str(x) #x
@@ -106,3 +114,188 @@ parse_options(
 
 	return 1;
 }
+
+
+/* INPUT */
+
+struct input_data {
+	const uint8_t *data;
+	size_t size;
+
+	void *map;		/* the mapping, if the file is mapped */
+	size_t map_size;
+	rfcdown_buffer *buf;	/* the contents, if the file was read */
+};
+
+/* read_input: maps a regular file whole when may_map is set, or reads it (in one go when its size is known); returns nonzero on I/O errors */
+int
+read_input(struct input_data *in, FILE *file, size_t unit, int may_map)
+{
+	size_t hint = 0;
+
+	in->data = NULL;
+	in->size = 0;
+	in->map = NULL;
+	in->map_size = 0;
+	in->buf = NULL;
+
+#ifndef _WIN32
+	{
+		struct stat st;
+		int fd = fileno(file);
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			if (may_map && S_ISREG(st.st_mode) && offset >= 0 && offset < st.st_size) {
+				void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+				if (map != MAP_FAILED) {
+					in->map = map;
+					in->map_size = (size_t)st.st_size;
+					in->data = (const uint8_t *)map + offset;
+					in->size = (size_t)(st.st_size - offset);
+					return 0;
+				}
+			}
+
+			hint = (size_t)st.st_size;
+		}
+	}
+#endif
+
+	in->buf = rfcdown_buffer_new(unit);
+	rfcdown_buffer_grow(in->buf, hint + 1);
+
+	/* doubling the buffer keeps reads of unknown size linear */
+	while (!(feof(file) || ferror(file))) {
+		if (in->buf->size == in->buf->asize)
+			rfcdown_buffer_grow(in->buf, in->buf->asize * 2);
+		in->buf->size += fread(in->buf->data + in->buf->size, 1, in->buf->asize - in->buf->size, file);
+	}
+
+	in->data = in->buf->data;
+	in->size = in->buf->size;
+	return ferror(file);
+}
+
+/* release_input: releases what read_input kept */
+void
+release_input(struct input_data *in)
+{
+#ifndef _WIN32
+	if (in->map)
+		munmap(in->map, in->map_size);
+#endif
+	rfcdown_buffer_free(in->buf);
+	in->map = NULL;
+	in->buf = NULL;
+}
+
+
+/* TIMING */
+
+#define MAX_PHASES 8
+
+/* phase_times: wall-clock time and bytes spent in each phase of a run */
+struct phase_times {
+	const char *const *names;
+	size_t count;
+	double ns[MAX_PHASES];
+	double bytes[MAX_PHASES];
+	double mark;
+};
+
+/* now_ns: a monotonic timestamp in nanoseconds (process time where there is no monotonic clock) */
+double
+now_ns(void)
+{
+#if !defined(_WIN32) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+#endif
+	return (double)clock() * (1e9 / CLOCKS_PER_SEC);
+}
+
+void
+phase_init(struct phase_times *times, const char *const *names, size_t count)
+{
+	size_t i;
+
+	times->names = names;
+	times->count = count;
+	for (i = 0; i < MAX_PHASES; i++)
+		times->ns[i] = times->bytes[i] = 0;
+	times->mark = now_ns();
+}
+
+/* phase_start: the next phase starts now */
+void
+phase_start(struct phase_times *times)
+{
+	times->mark = now_ns();
+}
+
+/* phase_end: the given phase ends now, having processed the given bytes; the next one starts */
+void
+phase_end(struct phase_times *times, size_t phase, size_t bytes)
+{
+	double now = now_ns();
+
+	times->ns[phase] += now - times->mark;
+	times->bytes[phase] += (double)bytes;
+	times->mark = now;
+}
+
+void
+phase_add(struct phase_times *total, const struct phase_times *times)
+{
+	size_t i;
+
+	for (i = 0; i < total->count; i++) {
+		total->ns[i] += times->ns[i];
+		total->bytes[i] += times->bytes[i];
+	}
+}
+
+void
+print_duration(double ns)
+{
+	if (ns < 1e9)
+		fprintf(stderr, "%9.3f ms", ns / 1e6);
+	else
+		fprintf(stderr, "%9.3f s ", ns / 1e9);
+}
+
+/* print_phase_times: reports each phase with its throughput on stderr, as text or as a JSON object */
+void
+print_phase_times(const struct phase_times *times, int json)
+{
+	double total = 0;
+	size_t i;
+
+	for (i = 0; i < times->count; i++)
+		total += times->ns[i];
+
+	if (json) {
+		fprintf(stderr, "{\"phases\": {");
+		for (i = 0; i < times->count; i++) {
+			fprintf(stderr, "%s\"%s\": {\"ns\": %.0f, \"bytes\": %.0f, \"bytes_per_s\": %.0f}",
+				i ? ", " : "", times->names[i], times->ns[i], times->bytes[i],
+				times->ns[i] > 0 ? times->bytes[i] * 1e9 / times->ns[i] : 0.0);
+		}
+		fprintf(stderr, "}, \"total_ns\": %.0f}\n", total);
+		return;
+	}
+
+	for (i = 0; i < times->count; i++) {
+		fprintf(stderr, "  %-12s", times->names[i]);
+		print_duration(times->ns[i]);
+		if (times->ns[i] > 0 && times->bytes[i] > 0)
+			fprintf(stderr, "  %9.1f MB/s", times->bytes[i] * 1e3 / times->ns[i]);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "  %-12s", "total");
+	print_duration(total);
+	fprintf(stderr, "\n");
+}
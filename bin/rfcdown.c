@@ -1,15 +1,39 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L	/* fileno, fstat, mmap */
+#endif
+
 #include "document.h"
 #include "html.h"
+#include "tee.h"
 
 #include "common.h"
+#include "stack.h"
 #include <time.h>
 
+#ifndef _WIN32
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <dirent.h>
+#include <utime.h>
+#define RFCDOWN_JOBS
+#define RFCDOWN_SERVE
+#define RFCDOWN_CACHE
+#define RFCDOWN_WATCH
+#endif
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
 
 /* FEATURES INFO / DEFAULTS */
 
 enum renderer_type {
 	RENDERER_HTML,
-	RENDERER_HTML_TOC
+	RENDERER_HTML_TOC,
+	RENDERER_HTML_WITH_TOC
 };
 
 struct extension_category_info {
@@ -62,6 +86,7 @@ static struct html_flag_info html_flags_info[] = {
 	{RFCDOWN_HTML_ESCAPE, "escape", "Escape all HTML."},
 	{RFCDOWN_HTML_HARD_WRAP, "hard-wrap", "Render each linebreak as <br>."},
 	{RFCDOWN_HTML_USE_XHTML, "xhtml", "Render XHTML."},
+	{RFCDOWN_HTML_SMARTYPANTS, "smartypants", "Apply SmartyPants smart punctuation to the text as it is rendered."},
 };
 
 static const char *category_prefix = "all-";
@@ -70,6 +95,11 @@ static const char *negative_prefix = "no-";
 #define DEF_IUNIT 1024
 #define DEF_OUNIT 64
 #define DEF_MAX_NESTING 16
+#define DEF_SUFFIX ".html"
+#define SERVE_CACHE 8
+#define DEF_CACHE_SIZE 256
+#define WATCH_POLL_MS 200
+#define SERVE_MAX_REQUEST (64 << 20)
 
 
 /* PRINT HELP */
@@ -81,10 +111,10 @@ print_help(const char *basename)
 	size_t e;
 
 	/* usage */
-	printf("Usage: %s [OPTION]... [FILE]\n\n", basename);
+	printf("Usage: %s [OPTION]... [FILE]...\n\n", basename);
 
 	/* description */
-	printf("Process the Markdown in FILE (or standard input) and render it to standard output, using the Hoedown library. "
+	printf("Process the Markdown in each FILE (or standard input) and render it to standard output, using the Hoedown library. "
 	       "Parsing and rendering can be customized through the options below. The default is to parse pure markdown and output HTML.\n\n");
 
 	/* main options */
@@ -93,9 +123,22 @@ print_help(const char *basename)
 	print_option('t', "toc-level=N", "Maximum level for headers included in the TOC. Zero disables TOC (the default).");
 	print_option(  0, "html", "Render (X)HTML. The default.");
 	print_option(  0, "html-toc", "Render the Table of Contents in (X)HTML.");
-	print_option('T', "time", "Show time spent in rendering.");
+	print_option(  0, "html-with-toc", "Render the Table of Contents, then the (X)HTML, from a single parse.");
+	print_option('T', "time", "Show time spent in each phase of rendering, and its throughput.");
+	print_option(  0, "time-json", "Like --time, as a JSON object.");
+	print_option(  0, "serve", "Render framed requests from standard input to standard output, or over --socket, instead of FILEs.");
+	print_option(  0, "socket=PATH", "Listen on the Unix socket PATH with --serve, until SIGINT or SIGTERM. A socket left there by a stopped server is replaced.");
+	print_option(  0, "watch", "Render FILE again, reusing unchanged blocks, each time it is saved. Runs until interrupted.");
+	print_option(  0, "output=OUT", "Write the output to OUT rather than standard output (for --watch).");
+	print_option('j', "jobs=N", "Render N files at a time, each on its own thread and parser. Default is 1.");
+	print_option(  0, "threads=N", "Render top-level blocks on N threads (HTML renderer, no footnotes). Default is 1.");
 	print_option('i', "input-unit=N", "Reading block size. Default is " str(DEF_IUNIT) ".");
 	print_option('o', "output-unit=N", "Writing block size. Default is " str(DEF_OUNIT) ".");
+	print_option(  0, "files-from=FILE", "Also read input paths from FILE, one per line ('-' for standard input).");
+	print_option(  0, "output-dir=DIR", "Write the output of each FILE to DIR, named after it.");
+	print_option(  0, "suffix=SUFFIX", "Replace the extension of each FILE by SUFFIX to name its output. Default with --output-dir is " DEF_SUFFIX ".");
+	print_option(  0, "cache-dir=DIR", "Keep rendered outputs in DIR, keyed by input and options, and reuse them.");
+	print_option(  0, "cache-size=N", "Maximum size of the cache in MiB; the least recently used outputs go first. Default is " str(DEF_CACHE_SIZE) ".");
 	print_option('h', "help", "Print this help text.");
 	print_option('v', "version", "Print Hoedown version.");
 	printf("\n");
@@ -121,11 +164,18 @@ print_help(const char *basename)
 	}
 	printf("\n");
 
+	/* serving */
+	printf("With --serve, each request is a header of four 32-bit big-endian words (extensions, HTML flags, TOC level, "
+	       "payload length) followed by the Markdown payload, and each reply is a 32-bit big-endian length followed by the output. "
+	       "Other options apply as usual, except that the request picks the extensions, HTML flags and TOC level.\n\n");
+
 	/* ending */
 	printf("Flags and extensions can be negated by prepending 'no' to them, as in '--no-tables', '--no-span' or '--no-escape'. "
 	       "Options are processed in order, so in case of contradictory options the last specified stands.\n\n");
 
 	printf("When FILE is '-', read standard input. If no FILE was given, read standard input. Use '--' to signal end of option parsing. "
+	       "Several files are rendered one after the other with the same parser; their outputs are concatenated unless --output-dir or --suffix is given "
+	       "(standard input always goes to standard output). "
 	       "Exit status is 0 if no errors occurred, 1 with option parsing errors, 4 with memory allocation errors or 5 with I/O errors.\n\n");
 }
 
@@ -137,12 +187,15 @@ struct option_data {
 	int done;
 
 	/* time reporting */
-	int show_time;
+	int show_time;	/* 2 for JSON */
 
 	/* I/O */
 	size_t iunit;
 	size_t ounit;
-	const char *filename;
+	rfcdown_stack filenames;	/* NULL stands for standard input */
+	const char *files_from;
+	const char *output_dir;
+	const char *suffix;
 
 	/* renderer */
 	enum renderer_type renderer;
@@ -152,6 +205,20 @@ struct option_data {
 	/* parsing */
 	rfcdown_extensions extensions;
 	size_t max_nesting;
+	unsigned int threads;
+	unsigned int jobs;
+
+	/* cache */
+	const char *cache_dir;
+	unsigned long cache_size;
+
+	/* serving */
+	int serve;
+	const char *socket_path;
+
+	/* watching */
+	int watch;
+	const char *output;
 };
 
 int
@@ -201,6 +268,11 @@ parse_short_option(char opt, char *next, void *opaque)
 		return 2;
 	}
 
+	if (opt == 'j' && isNum) {
+		data->jobs = num;
+		return 2;
+	}
+
 	fprintf(stderr, "Wrong option '-%c' found.\n", opt);
 	return 0;
 }
@@ -305,6 +377,11 @@ parse_long_option(char *opt, char *next, void *opaque)
 		return 1;
 	}
 
+	if (strcmp(opt, "time-json")==0) {
+		data->show_time = 2;
+		return 1;
+	}
+
 	/* FIXME: validation */
 
 	if (strcmp(opt, "max-nesting")==0 && isNum) {
@@ -323,6 +400,50 @@ parse_long_option(char *opt, char *next, void *opaque)
 		data->ounit = num;
 		return 2;
 	}
+	if (strcmp(opt, "threads")==0 && isNum) {
+		data->threads = num;
+		return 2;
+	}
+	if (strcmp(opt, "cache-dir")==0 && next) {
+		data->cache_dir = next;
+		return 2;
+	}
+	if (strcmp(opt, "cache-size")==0 && isNum) {
+		data->cache_size = num;
+		return 2;
+	}
+	if (strcmp(opt, "watch")==0) {
+		data->watch = 1;
+		return 1;
+	}
+	if (strcmp(opt, "output")==0 && next) {
+		data->output = next;
+		return 2;
+	}
+	if (strcmp(opt, "serve")==0) {
+		data->serve = 1;
+		return 1;
+	}
+	if (strcmp(opt, "socket")==0 && next) {
+		data->socket_path = next;
+		return 2;
+	}
+	if (strcmp(opt, "jobs")==0 && isNum) {
+		data->jobs = num;
+		return 2;
+	}
+	if (strcmp(opt, "files-from")==0 && next) {
+		data->files_from = next;
+		return 2;
+	}
+	if (strcmp(opt, "output-dir")==0 && next) {
+		data->output_dir = next;
+		return 2;
+	}
+	if (strcmp(opt, "suffix")==0 && next) {
+		data->suffix = next;
+		return 2;
+	}
 
 	if (strcmp(opt, "html")==0) {
 		data->renderer = RENDERER_HTML;
@@ -332,6 +453,10 @@ parse_long_option(char *opt, char *next, void *opaque)
 		data->renderer = RENDERER_HTML_TOC;
 		return 1;
 	}
+	if (strcmp(opt, "html-with-toc")==0) {
+		data->renderer = RENDERER_HTML_WITH_TOC;
+		return 1;
+	}
 
 	if (parse_category_option(opt, data) || parse_flag_option(opt, data) || parse_negative_option(opt, data))
 		return 1;
@@ -345,29 +470,1274 @@ parse_argument(int argn, char *arg, int is_forced, void *opaque)
 {
 	struct option_data *data = opaque;
 
-	if (argn == 0) {
-		/* Input file */
-		if (strcmp(arg, "-")!=0 || is_forced) data->filename = arg;
+	/* Input file */
+	rfcdown_stack_push(&data->filenames, (strcmp(arg, "-")!=0 || is_forced) ? arg : NULL);
+	return 1;
+}
+
+/* read_manifest: adds the paths listed in data->files_from to the input files; returns nonzero on I/O errors */
+int
+read_manifest(struct option_data *data, rfcdown_buffer *manifest)
+{
+	FILE *file = stdin;
+	struct input_data in;
+	size_t i, beg;
+
+	if (strcmp(data->files_from, "-")!=0) {
+		file = fopen(data->files_from, "r");
+		if (!file) {
+			fprintf(stderr, "Unable to open file list \"%s\": %s\n", data->files_from, strerror(errno));
+			return 1;
+		}
+	}
+
+	if (read_input(&in, file, data->iunit, 1)) {
+		fprintf(stderr, "I/O errors found while reading file list.\n");
+		if (file != stdin) fclose(file);
 		return 1;
 	}
 
-	fprintf(stderr, "Too many arguments.\n");
+	/* the paths point into our own copy, split in place */
+	rfcdown_buffer_put(manifest, in.data, in.size);
+	rfcdown_buffer_putc(manifest, '\n');
+	release_input(&in);
+	if (file != stdin) fclose(file);
+
+	for (i = beg = 0; i < manifest->size; i++) {
+		size_t end = i;
+		if (manifest->data[i] != '\n') continue;
+
+		if (end > beg && manifest->data[end - 1] == '\r') end--;
+		manifest->data[end] = '\0';
+		if (end > beg) rfcdown_stack_push(&data->filenames, manifest->data + beg);
+		beg = i + 1;
+	}
+
 	return 0;
 }
 
 
+/* RENDER CACHE */
+
+#ifdef RFCDOWN_CACHE
+
+/* Entries are files named after the 64-bit key in hex, holding the output.
+ * They are written to a temporary name first and renamed into place, so a
+ * concurrent reader sees either nothing or a whole entry. A hit refreshes
+ * the modification time, which eviction uses to find the least recently
+ * used entries. */
+
+#define CACHE_KEY_LEN 16
+
+struct cache_key {
+	uint32_t hi, lo;
+};
+
+static uint64_t
+cache_mix(uint64_t h, uint64_t w)
+{
+	const uint64_t k1 = ((uint64_t)0x9e3779b9 << 32) | 0x7f4a7c15;
+	const uint64_t k2 = ((uint64_t)0xbf58476d << 32) | 0x1ce4e5b9;
+
+	w *= k1;
+	w ^= w >> 31;
+	h = (h ^ w) * k2;
+	return h ^ (h >> 29);
+}
+
+/* cache_hash: hashes size bytes eight at a time */
+static uint64_t
+cache_hash(uint64_t h, const uint8_t *data, size_t size)
+{
+	uint64_t w;
+
+	h = cache_mix(h, size);
+	for (; size >= 8; data += 8, size -= 8) {
+		memcpy(&w, data, 8);
+		h = cache_mix(h, w);
+	}
+
+	w = 0;
+	memcpy(&w, data, size);
+	return cache_mix(h, w);
+}
+
+/* cache_key: the key of the output for the given input and options */
+static struct cache_key
+cache_key(const struct option_data *data, const uint8_t *text, size_t size)
+{
+	struct cache_key key;
+	uint64_t h = 0;
+
+	/* everything that changes the output, --threads excepted */
+	h = cache_hash(h, (const uint8_t *)RFCDOWN_VERSION, strlen(RFCDOWN_VERSION));
+	h = cache_mix(h, data->renderer);
+	h = cache_mix(h, data->extensions);
+	h = cache_mix(h, data->html_flags);
+	h = cache_mix(h, data->toc_level);
+	h = cache_mix(h, data->max_nesting);
+	h = cache_hash(h, text, size);
+
+	key.hi = (uint32_t)(h >> 32);
+	key.lo = (uint32_t)h;
+	return key;
+}
+
+static const char *
+cache_path(rfcdown_buffer *path, const char *dir, const char *name)
+{
+	path->size = 0;
+	rfcdown_buffer_puts(path, dir);
+	if (path->size && path->data[path->size - 1] != '/')
+		rfcdown_buffer_putc(path, '/');
+	rfcdown_buffer_puts(path, name);
+	return rfcdown_buffer_cstr(path);
+}
+
+/* cache_fetch: puts the cached output for key in ob; returns 1 on a hit */
+static int
+cache_fetch(rfcdown_buffer *ob, rfcdown_buffer *path, const char *dir, struct cache_key key)
+{
+	char name[CACHE_KEY_LEN + 1];
+	struct input_data in;
+	FILE *file;
+	int error;
+
+	sprintf(name, "%08lx%08lx", (unsigned long)key.hi, (unsigned long)key.lo);
+	file = fopen(cache_path(path, dir, name), "rb");
+	if (!file) return 0;
+
+	error = read_input(&in, file, 0, 1);
+	if (!error) {
+		ob->size = 0;
+		rfcdown_buffer_put(ob, in.data, in.size);
+		release_input(&in);
+	}
+	fclose(file);
+
+	if (!error) utime(rfcdown_buffer_cstr(path), NULL);
+	return !error;
+}
+
+/* cache_store: adds ob as the output for key; the cache is best effort, so errors are ignored */
+static void
+cache_store(const rfcdown_buffer *ob, rfcdown_buffer *path, const char *dir, struct cache_key key, unsigned int worker)
+{
+	char name[64];
+	rfcdown_buffer *tmp;
+	FILE *file;
+	int error;
+
+	sprintf(name, ".tmp-%lu-%u", (unsigned long)getpid(), worker);
+	tmp = rfcdown_buffer_new(64);
+	file = fopen(cache_path(tmp, dir, name), "wb");
+	if (!file) {
+		rfcdown_buffer_free(tmp);
+		return;
+	}
+
+	(void)fwrite(ob->data, 1, ob->size, file);
+	error = ferror(file);
+	if (fclose(file) != 0) error = 1;
+
+	sprintf(name, "%08lx%08lx", (unsigned long)key.hi, (unsigned long)key.lo);
+	if (error || rename(rfcdown_buffer_cstr(tmp), cache_path(path, dir, name)) != 0)
+		remove(rfcdown_buffer_cstr(tmp));
+	rfcdown_buffer_free(tmp);
+}
+
+struct cache_entry {
+	char name[CACHE_KEY_LEN + 1];
+	double size;
+	time_t used;
+};
+
+static int
+cmp_cache_entry(const void *a, const void *b)
+{
+	const struct cache_entry *x = a, *y = b;
+	return (x->used > y->used) - (x->used < y->used);
+}
+
+/* cache_evict: removes the least recently used entries until the cache fits in limit bytes */
+static void
+cache_evict(const char *dir, double limit)
+{
+	struct cache_entry *entries = NULL;
+	size_t count = 0, asize = 0, i;
+	rfcdown_buffer *path;
+	struct dirent *ent;
+	double total = 0;
+	DIR *d;
+
+	d = opendir(dir);
+	if (!d) return;
+
+	path = rfcdown_buffer_new(64);
+	while ((ent = readdir(d)) != NULL) {
+		struct stat st;
+
+		if (strlen(ent->d_name) != CACHE_KEY_LEN || strspn(ent->d_name, "0123456789abcdef") != CACHE_KEY_LEN)
+			continue;
+		if (stat(cache_path(path, dir, ent->d_name), &st) != 0)
+			continue;
+
+		if (count == asize) {
+			asize = asize ? asize * 2 : 64;
+			entries = rfcdown_realloc(entries, asize * sizeof *entries);
+		}
+		strcpy(entries[count].name, ent->d_name);
+		entries[count].size = (double)st.st_size;
+		entries[count].used = st.st_mtime;
+		total += entries[count].size;
+		count++;
+	}
+	closedir(d);
+
+	if (total > limit) {
+		qsort(entries, count, sizeof *entries, cmp_cache_entry);
+		for (i = 0; i < count && total > limit; i++) {
+			if (remove(cache_path(path, dir, entries[i].name)) == 0)
+				total -= entries[i].size;
+		}
+	}
+
+	rfcdown_buffer_free(path);
+	free(entries);
+}
+
+#endif
+
+
 /* MAIN LOGIC */
 
+enum phase {
+	PHASE_READ,
+	PHASE_PREPARE,		/* first pass */
+	PHASE_RENDER,		/* second pass */
+	PHASE_FOOTNOTES,
+	PHASE_WRITE,
+	PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {
+	"read", "pass1", "pass2", "footnotes", "write"
+};
+
+struct batch_data {
+	rfcdown_renderer *renderer;
+	void (*renderer_free)(rfcdown_renderer *);
+	rfcdown_renderer *parts[2];	/* renderers behind a tee, if any */
+	rfcdown_buffer *part_obs[2];	/* and their outputs */
+	size_t part_count;
+	const rfcdown_chunk_hooks *chunk_hooks;
+	rfcdown_document *document;
+	rfcdown_buffer *ob;
+	rfcdown_buffer *path;
+	rfcdown_buffer *cache_path;
+	unsigned int id;	/* tells workers apart */
+
+	/* totals */
+	struct phase_times times;
+	size_t files;
+	size_t bytes;
+	size_t cached;
+	int status;
+};
+
+/* document_phase: the library reports the end of each of its phases */
+static void
+document_phase(void *opaque, rfcdown_phase phase, size_t bytes)
+{
+	switch (phase) {
+		case RFCDOWN_PHASE_PREPARE: phase_end(opaque, PHASE_PREPARE, bytes); break;
+		case RFCDOWN_PHASE_RENDER: phase_end(opaque, PHASE_RENDER, bytes); break;
+		case RFCDOWN_PHASE_FOOTNOTES: phase_end(opaque, PHASE_FOOTNOTES, bytes); break;
+	}
+}
+
+void
+batch_init(struct batch_data *batch, const struct option_data *data)
+{
+	batch->renderer = NULL;
+	batch->renderer_free = NULL;
+	batch->part_count = 0;
+	batch->chunk_hooks = NULL;
+
+	/* Create the renderer */
+	switch (data->renderer) {
+		case RENDERER_HTML:
+			batch->renderer = rfcdown_html_renderer_new(data->html_flags, data->toc_level);
+			batch->renderer_free = rfcdown_html_renderer_free;
+			batch->chunk_hooks = rfcdown_html_chunk_hooks();
+			break;
+		case RENDERER_HTML_TOC:
+			batch->renderer = rfcdown_html_toc_renderer_new(data->toc_level);
+			batch->renderer_free = rfcdown_html_renderer_free;
+			break;
+		case RENDERER_HTML_WITH_TOC:
+			batch->parts[0] = rfcdown_html_toc_renderer_new(data->toc_level);
+			batch->parts[1] = rfcdown_html_renderer_new(data->html_flags, data->toc_level);
+			batch->part_obs[0] = rfcdown_buffer_new(data->ounit);
+			batch->part_obs[1] = rfcdown_buffer_new(data->ounit);
+			batch->part_count = 2;
+			batch->renderer = rfcdown_tee_renderer_new((const rfcdown_renderer *const *)batch->parts, batch->part_obs, 2);
+			batch->renderer_free = rfcdown_tee_renderer_free;
+			break;
+	};
+
+	/* One document and output buffer serve every file */
+	batch->document = rfcdown_document_new(batch->renderer, data->extensions, data->max_nesting);
+	batch->ob = rfcdown_buffer_new(data->ounit);
+	batch->path = rfcdown_buffer_new(64);
+	batch->cache_path = rfcdown_buffer_new(64);
+	batch->id = 0;
+	phase_init(&batch->times, phase_names, PHASE_COUNT);
+	rfcdown_document_set_phase_callback(batch->document, document_phase, &batch->times);
+	batch->files = 0;
+	batch->bytes = 0;
+	batch->cached = 0;
+	batch->status = 0;
+}
+
+void
+batch_uninit(struct batch_data *batch)
+{
+	size_t i;
+
+	rfcdown_document_free(batch->document);
+	batch->renderer_free(batch->renderer);
+	for (i = 0; i < batch->part_count; i++) {
+		rfcdown_html_renderer_free(batch->parts[i]);
+		rfcdown_buffer_free(batch->part_obs[i]);
+	}
+	rfcdown_buffer_free(batch->ob);
+	rfcdown_buffer_free(batch->path);
+	rfcdown_buffer_free(batch->cache_path);
+}
+
+/* totals_init: prepares a batch that only collects the totals of others */
+void
+totals_init(struct batch_data *total)
+{
+	memset(total, 0, sizeof *total);
+	phase_init(&total->times, phase_names, PHASE_COUNT);
+}
+
+void
+add_totals(struct batch_data *total, const struct batch_data *batch)
+{
+	phase_add(&total->times, &batch->times);
+	total->files += batch->files;
+	total->bytes += batch->bytes;
+	total->cached += batch->cached;
+	if (batch->status) total->status = batch->status;
+}
+
+/* output_path: name of the output for the given input, or NULL for standard output */
+const char *
+output_path(struct batch_data *batch, const struct option_data *data, const char *filename)
+{
+	const char *base, *ext;
+
+	if (!filename || !(data->output_dir || data->suffix))
+		return NULL;
+
+	base = strrchr(filename, '/');
+	base = base ? base + 1 : filename;
+	ext = strrchr(base, '.');
+	if (!ext || ext == base) ext = base + strlen(base);
+
+	batch->path->size = 0;
+	if (data->output_dir) {
+		rfcdown_buffer_puts(batch->path, data->output_dir);
+		if (batch->path->size && batch->path->data[batch->path->size - 1] != '/')
+			rfcdown_buffer_putc(batch->path, '/');
+		rfcdown_buffer_put(batch->path, (const uint8_t *)base, ext - base);
+	} else {
+		rfcdown_buffer_put(batch->path, (const uint8_t *)filename, ext - filename);
+	}
+	rfcdown_buffer_puts(batch->path, data->suffix ? data->suffix : DEF_SUFFIX);
+
+	return rfcdown_buffer_cstr(batch->path);
+}
+
+/* restart_numbering: header numbering starts over with each file */
+static void
+restart_numbering(rfcdown_renderer *renderer)
+{
+	rfcdown_html_renderer_state *state = renderer->opaque;
+
+	state->toc_data.header_count = 0;
+	state->toc_data.current_level = 0;
+	state->toc_data.level_offset = 0;
+}
+
+/* start_render: readies the renderers and batch->ob for a file */
+static void
+start_render(struct batch_data *batch)
+{
+	size_t i;
+
+	batch->ob->size = 0;
+	if (!batch->part_count)
+		restart_numbering(batch->renderer);
+
+	for (i = 0; i < batch->part_count; i++) {
+		restart_numbering(batch->parts[i]);
+		batch->part_obs[i]->size = 0;
+	}
+}
+
+/* finish_render: puts the output of the renderers behind a tee into batch->ob, one after the other */
+static void
+finish_render(struct batch_data *batch)
+{
+	size_t i;
+
+	for (i = 0; i < batch->part_count; i++)
+		rfcdown_buffer_put(batch->ob, batch->part_obs[i]->data, batch->part_obs[i]->size);
+}
+
+/* render_data: renders the given Markdown into batch->ob */
+void
+render_data(struct batch_data *batch, const struct option_data *data, const uint8_t *text, size_t size)
+{
+	start_render(batch);
+
+	/* Perform Markdown rendering */
+	/* The document ends each of its phases through document_phase */
+	phase_start(&batch->times);
+	rfcdown_document_render_parallel(batch->document, batch->ob, text, size, batch->chunk_hooks, data->threads);
+	finish_render(batch);
+	batch->files++;
+	batch->bytes += size;
+}
+
+/* render_input: renders one input into batch->ob; returns the exit status */
+int
+render_input(struct batch_data *batch, const struct option_data *data, const char *filename)
+{
+	FILE *file = stdin;
+	struct input_data in;
+
+	/* Open input file, if needed */
+	phase_start(&batch->times);
+	if (filename) {
+		file = fopen(filename, "r");
+		if (!file) {
+			fprintf(stderr, "Unable to open input file \"%s\": %s\n", filename, strerror(errno));
+			return 5;
+		}
+	}
+
+	/* Read everything */
+	if (read_input(&in, file, data->iunit, 1)) {
+		fprintf(stderr, "I/O errors found while reading %s.\n", filename ? filename : "input");
+		if (file != stdin) fclose(file);
+		return 5;
+	}
+	phase_end(&batch->times, PHASE_READ, in.size);
+
+#ifdef RFCDOWN_CACHE
+	if (data->cache_dir) {
+		struct cache_key key = cache_key(data, in.data, in.size);
+
+		/* a hit counts as reading, since nothing gets parsed */
+		if (cache_fetch(batch->ob, batch->cache_path, data->cache_dir, key)) {
+			phase_end(&batch->times, PHASE_READ, 0);
+			batch->cached++;
+		} else {
+			render_data(batch, data, in.data, in.size);
+			cache_store(batch->ob, batch->cache_path, data->cache_dir, key, batch->id);
+			phase_end(&batch->times, PHASE_WRITE, 0);
+		}
+
+		release_input(&in);
+		if (file != stdin) fclose(file);
+		return 0;
+	}
+#endif
+
+	render_data(batch, data, in.data, in.size);
+
+	release_input(&in);
+	if (file != stdin) fclose(file);
+	return 0;
+}
+
+/* write_output: writes ob to the given path, or to stdout if NULL; returns the exit status */
+int
+write_output(const rfcdown_buffer *ob, const char *path)
+{
+	FILE *out = stdout;
+	int error;
+
+	if (path) {
+		out = fopen(path, "wb");
+		if (!out) {
+			fprintf(stderr, "Unable to open output file \"%s\": %s\n", path, strerror(errno));
+			return 5;
+		}
+	}
+
+	(void)fwrite(ob->data, 1, ob->size, out);
+	error = ferror(out);
+	if (out != stdout && fclose(out) != 0) error = 1;
+
+	if (error) {
+		fprintf(stderr, "I/O errors found while writing %s.\n", path ? path : "output");
+		return 5;
+	}
+
+	return 0;
+}
+
+/* render_file: renders one input to its output; returns the exit status */
+int
+render_file(struct batch_data *batch, const struct option_data *data, const char *filename)
+{
+	int status = render_input(batch, data, filename);
+	if (status) return status;
+
+	phase_start(&batch->times);
+	status = write_output(batch->ob, output_path(batch, data, filename));
+	phase_end(&batch->times, PHASE_WRITE, batch->ob->size);
+	return status;
+}
+
+
+/* PARALLEL JOBS */
+
+struct job_queue {
+	const struct option_data *data;
+	size_t *order;			/* file indexes, largest file first */
+	size_t jobs;			/* entries in order */
+	size_t next;			/* next entry of order to hand out */
+	size_t *same;			/* next file with the same output file, or the file count */
+
+	/* outputs bound for stdout, written in input order */
+	rfcdown_buffer **results;
+	unsigned char *done;
+	size_t flushed;
+	int status;
+
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_t lock;
+	pthread_mutex_t out_lock;
+#endif
+};
+
+struct job_worker {
+	struct job_queue *queue;
+	struct batch_data batch;
+#ifdef RFCDOWN_JOBS
+	pthread_t thread;
+#endif
+};
+
+struct job_order {
+	size_t index;
+	long size;
+};
+
+static int
+cmp_job_order(const void *a, const void *b)
+{
+	const struct job_order *x = a, *y = b;
+	if (x->size != y->size) return x->size > y->size ? -1 : 1;
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+/* sort_jobs: indexes of the files starting a chain by decreasing size, so the longest renders start first */
+static void
+sort_jobs(size_t *order, const unsigned char *chained, const rfcdown_stack *filenames)
+{
+	struct job_order *sizes = rfcdown_malloc(filenames->size * sizeof *sizes);
+	size_t i, n;
+
+	for (i = 0; i < filenames->size; i++) {
+		const char *filename = filenames->item[i];
+		sizes[i].index = i;
+		sizes[i].size = 0;
+#ifndef _WIN32
+		{
+			struct stat st;
+			if (filename && stat(filename, &st) == 0)
+				sizes[i].size = (long)st.st_size;
+		}
+#endif
+	}
+
+	qsort(sizes, filenames->size, sizeof *sizes, cmp_job_order);
+	for (i = 0, n = 0; i < filenames->size; i++)
+		if (!chained[sizes[i].index])
+			order[n++] = sizes[i].index;
+	free(sizes);
+}
+
+struct job_output {
+	size_t index;
+	size_t name;	/* offset of the output path */
+	const rfcdown_buffer *names;
+};
+
+static int
+cmp_job_output(const void *a, const void *b)
+{
+	const struct job_output *x = a, *y = b;
+	int cmp = strcmp((const char *)x->names->data + x->name, (const char *)y->names->data + y->name);
+	if (cmp) return cmp;
+	return x->index < y->index ? -1 : (x->index > y->index);
+}
+
+/* chain_outputs: links each file to the next one writing the same output file, so that
+ * one job renders them all in input order as a single run would; returns the files that
+ * start a chain, which are the jobs to hand out */
+static size_t
+chain_outputs(size_t *same, unsigned char *chained, struct batch_data *batch, const struct option_data *data)
+{
+	size_t count = data->filenames.size;
+	struct job_output *outputs = rfcdown_malloc(count * sizeof *outputs);
+	rfcdown_buffer *names = rfcdown_buffer_new(256);
+	size_t i, n = 0, heads = count;
+
+	for (i = 0; i < count; i++) {
+		const char *path = output_path(batch, data, data->filenames.item[i]);
+		same[i] = count;
+
+		/* outputs bound for stdout are already written in order */
+		if (!path) continue;
+		outputs[n].index = i;
+		outputs[n].name = names->size;
+		outputs[n].names = names;
+		rfcdown_buffer_put(names, (const uint8_t *)path, strlen(path) + 1);
+		n++;
+	}
+
+	/* the same paths end up next to each other, in input order */
+	qsort(outputs, n, sizeof *outputs, cmp_job_output);
+	for (i = 1; i < n; i++) {
+		if (strcmp((const char *)names->data + outputs[i - 1].name, (const char *)names->data + outputs[i].name))
+			continue;
+		same[outputs[i - 1].index] = outputs[i].index;
+		chained[outputs[i].index] = 1;
+		heads--;
+	}
+
+	rfcdown_buffer_free(names);
+	free(outputs);
+	return heads;
+}
+
+static int
+next_job(struct job_queue *queue, size_t *index)
+{
+	int found = 0;
+
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_lock(&queue->lock);
+#endif
+	if (queue->next < queue->jobs) {
+		*index = queue->order[queue->next++];
+		found = 1;
+	}
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_unlock(&queue->lock);
+#endif
+	return found;
+}
+
+/* finish_stdout_job: hands over the output of file index (NULL if it failed or went to its own file) and writes whatever is next in order */
+static void
+finish_stdout_job(struct job_queue *queue, size_t index, rfcdown_buffer *ob)
+{
+	size_t count = queue->data->filenames.size;
+
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_lock(&queue->out_lock);
+#endif
+	queue->results[index] = ob;
+	queue->done[index] = 1;
+
+	while (queue->flushed < count && queue->done[queue->flushed]) {
+		rfcdown_buffer *result = queue->results[queue->flushed];
+		if (result) {
+			if (write_output(result, NULL)) queue->status = 5;
+			rfcdown_buffer_free(result);
+			queue->results[queue->flushed] = NULL;
+		}
+		queue->flushed++;
+	}
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_unlock(&queue->out_lock);
+#endif
+}
+
+/* run_job: renders file index and hands it over to the queue */
+static void
+run_job(struct job_worker *worker, size_t index)
+{
+	struct job_queue *queue = worker->queue;
+	const struct option_data *data = queue->data;
+	struct batch_data *batch = &worker->batch;
+	const char *filename = data->filenames.item[index];
+	const char *path = output_path(batch, data, filename);
+	int status = render_input(batch, data, filename);
+	size_t size = batch->ob->size;
+
+	/* handing over to the queue may mean writing, or waiting for the lock */
+	phase_start(&batch->times);
+	if (path || status) {
+		if (path && !status) status = write_output(batch->ob, path);
+		finish_stdout_job(queue, index, NULL);
+	} else {
+		/* the output now belongs to the queue */
+		finish_stdout_job(queue, index, batch->ob);
+		batch->ob = rfcdown_buffer_new(data->ounit);
+	}
+	if (!status) phase_end(&batch->times, PHASE_WRITE, size);
+
+	if (status) batch->status = status;
+}
+
+static void *
+job_worker(void *opaque)
+{
+	struct job_worker *worker = opaque;
+	struct job_queue *queue = worker->queue;
+	size_t count = queue->data->filenames.size;
+	size_t index;
+
+	/* files sharing an output file are rendered one after the other */
+	while (next_job(queue, &index))
+		for (; index < count; index = queue->same[index])
+			run_job(worker, index);
+
+	return NULL;
+}
+
+/* run_jobs: renders all files on the given number of workers, the calling thread being one of them */
+static void
+run_jobs(struct batch_data *total, const struct option_data *data, unsigned int jobs)
+{
+	struct job_queue queue;
+	struct job_worker *workers;
+	unsigned char *chained;
+	size_t count = data->filenames.size;
+	unsigned int i, started = 0;
+
+	queue.data = data;
+	queue.order = rfcdown_malloc(count * sizeof *queue.order);
+	queue.next = 0;
+	queue.same = rfcdown_malloc(count * sizeof *queue.same);
+	queue.results = rfcdown_calloc(count, sizeof *queue.results);
+	queue.done = rfcdown_calloc(count, 1);
+	queue.flushed = 0;
+	queue.status = 0;
+
+	workers = rfcdown_malloc(jobs * sizeof *workers);
+	for (i = 0; i < jobs; i++) {
+		workers[i].queue = &queue;
+		batch_init(&workers[i].batch, data);
+		workers[i].batch.id = i;
+	}
+
+	chained = rfcdown_calloc(count, 1);
+	queue.jobs = chain_outputs(queue.same, chained, &workers[0].batch, data);
+	sort_jobs(queue.order, chained, &data->filenames);
+	free(chained);
+
+#ifdef RFCDOWN_JOBS
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_mutex_init(&queue.out_lock, NULL);
+
+	/* if a thread can't be started, the others pick up its share */
+	while (started + 1 < jobs && pthread_create(&workers[started].thread, NULL, job_worker, &workers[started]) == 0)
+		started++;
+#endif
+
+	job_worker(&workers[jobs - 1]);
+
+#ifdef RFCDOWN_JOBS
+	for (i = 0; i < started; i++)
+		pthread_join(workers[i].thread, NULL);
+
+	pthread_mutex_destroy(&queue.lock);
+	pthread_mutex_destroy(&queue.out_lock);
+#endif
+
+	/* Add up the totals */
+	for (i = 0; i < jobs; i++) {
+		add_totals(total, &workers[i].batch);
+		batch_uninit(&workers[i].batch);
+	}
+	if (queue.status) total->status = queue.status;
+
+	free(workers);
+	free(queue.order);
+	free(queue.same);
+	free(queue.results);
+	free(queue.done);
+}
+
+
+/* WATCHING */
+
+#ifdef RFCDOWN_WATCH
+
+struct watcher {
+	const char *filename;
+	struct stat last;
+	int fd;		/* inotify instance, or -1 to poll */
+};
+
+static void
+watch_init(struct watcher *w, const char *filename)
+{
+	w->filename = filename;
+	w->fd = -1;
+	if (stat(filename, &w->last) != 0)
+		memset(&w->last, 0, sizeof w->last);
+
+#ifdef __linux__
+	{
+		/* editors often save by renaming a new file over the old one, so
+		 * the directory is watched rather than the file */
+		const char *slash = strrchr(filename, '/');
+		rfcdown_buffer *dir = rfcdown_buffer_new(64);
+
+		if (!slash)
+			rfcdown_buffer_puts(dir, ".");
+		else if (slash == filename)
+			rfcdown_buffer_puts(dir, "/");
+		else
+			rfcdown_buffer_put(dir, (const uint8_t *)filename, slash - filename);
+
+		w->fd = inotify_init();
+		if (w->fd >= 0 && inotify_add_watch(w->fd, rfcdown_buffer_cstr(dir), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+			close(w->fd);
+			w->fd = -1;
+		}
+		rfcdown_buffer_free(dir);
+	}
+#endif
+}
+
+static void
+watch_uninit(struct watcher *w)
+{
+	if (w->fd >= 0) close(w->fd);
+}
+
+/* watch_wait: blocks until the file was written again; returns nonzero on errors */
+static int
+watch_wait(struct watcher *w)
+{
+#ifdef __linux__
+	if (w->fd >= 0) {
+		const char *base = strrchr(w->filename, '/');
+		char events[4096];
+
+		base = base ? base + 1 : w->filename;
+		for (;;) {
+			ssize_t size = read(w->fd, events, sizeof events), i = 0;
+
+			if (size < 0 && errno == EINTR) continue;
+			if (size <= 0) return 1;
+
+			while (i < size) {
+				struct inotify_event *ev = (struct inotify_event *)(events + i);
+				if (ev->len && strcmp(ev->name, base) == 0)
+					return 0;
+				i += sizeof(struct inotify_event) + ev->len;
+			}
+		}
+	}
+#endif
+
+	for (;;) {
+		struct timespec delay;
+		struct stat st;
+
+		delay.tv_sec = 0;
+		delay.tv_nsec = WATCH_POLL_MS * 1000000L;
+		nanosleep(&delay, NULL);
+
+		if (stat(w->filename, &st) != 0)
+			continue;
+		if (st.st_mtime != w->last.st_mtime || st.st_size != w->last.st_size || st.st_ino != w->last.st_ino) {
+			w->last = st;
+			return 0;
+		}
+	}
+}
+
+/* watch_render: renders the file once through inc; returns the exit status */
+static int
+watch_render(struct batch_data *batch, const struct option_data *data, rfcdown_incremental *inc)
+{
+	FILE *file = fopen(data->filenames.item[0], "r");
+	struct input_data in;
+	size_t blocks, rendered;
+	double start, end;
+	int status;
+
+	if (!file) {
+		fprintf(stderr, "Unable to open input file \"%s\": %s\n", (const char *)data->filenames.item[0], strerror(errno));
+		return 5;
+	}
+
+	/* an editor may truncate the file while it is mapped, which would
+	 * kill the watcher with SIGBUS, so it is read instead */
+	if (read_input(&in, file, data->iunit, 0)) {
+		fprintf(stderr, "I/O errors found while reading input.\n");
+		fclose(file);
+		return 5;
+	}
+
+	start_render(batch);
+	start = now_ns();
+	rfcdown_incremental_render(inc, batch->ob, in.data, in.size);
+	finish_render(batch);
+	end = now_ns();
+
+	release_input(&in);
+	fclose(file);
+
+	/* a previewer never sees half an output */
+	if (data->output) {
+		batch->path->size = 0;
+		rfcdown_buffer_puts(batch->path, data->output);
+		rfcdown_buffer_puts(batch->path, ".tmp");
+
+		status = write_output(batch->ob, rfcdown_buffer_cstr(batch->path));
+		if (!status && rename(rfcdown_buffer_cstr(batch->path), data->output) != 0) {
+			fprintf(stderr, "Unable to replace output file \"%s\": %s\n", data->output, strerror(errno));
+			status = 5;
+		}
+	} else {
+		status = write_output(batch->ob, NULL);
+		fflush(stdout);
+	}
+
+	if (data->show_time) {
+		rfcdown_incremental_stats(inc, &blocks, &rendered);
+		if (blocks)
+			fprintf(stderr, "Rendered %lu of %lu blocks in %.2f ms.\n",
+				(unsigned long)rendered, (unsigned long)blocks, (end - start) / 1e6);
+		else
+			fprintf(stderr, "Rendered everything in %.2f ms.\n", (end - start) / 1e6);
+	}
+
+	return status;
+}
+
+/* watch: renders FILE each time it changes, until an error; returns the exit status */
+static int
+watch(struct batch_data *batch, const struct option_data *data)
+{
+	rfcdown_incremental *inc = rfcdown_incremental_new(batch->document, batch->chunk_hooks);
+	struct watcher w;
+	int status;
+
+	/* a failed render is reported and waits for the next save */
+	watch_init(&w, data->filenames.item[0]);
+	do {
+		watch_render(batch, data, inc);
+	} while ((status = watch_wait(&w)) == 0);
+
+	watch_uninit(&w);
+	rfcdown_incremental_free(inc);
+
+	fprintf(stderr, "Unable to watch \"%s\".\n", (const char *)data->filenames.item[0]);
+	return status ? 5 : 0;
+}
+
+#endif
+
+
+/* SERVING */
+
+#ifdef RFCDOWN_SERVE
+
+/* serve_entry: a warm parser for one combination of request flags */
+struct serve_entry {
+	rfcdown_extensions extensions;
+	rfcdown_html_flags html_flags;
+	int toc_level;
+	unsigned long last_used;
+	int in_use;
+	struct batch_data batch;
+};
+
+struct serve_data {
+	const struct option_data *data;
+	struct serve_entry entries[SERVE_CACHE];
+	unsigned long requests;
+	rfcdown_buffer *request;
+
+	/* totals of evicted entries */
+	struct batch_data total;
+};
+
+static uint32_t
+read_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void
+write_be32(uint8_t *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+/* set by SIGINT and SIGTERM while serving a socket */
+static volatile sig_atomic_t serve_stopped = 0;
+
+static void
+serve_stop(int sig)
+{
+	serve_stopped = 1;
+}
+
+/* read_full: reads exactly size bytes; returns their count, less only at end of input, on error or when stopped */
+static size_t
+read_full(int fd, uint8_t *data, size_t size)
+{
+	size_t done = 0;
+
+	while (done < size) {
+		ssize_t ret = read(fd, data + done, size - done);
+		if (ret < 0 && errno == EINTR && !serve_stopped) continue;
+		if (ret <= 0) break;
+		done += ret;
+	}
+
+	return done;
+}
+
+/* write_full: returns nonzero on errors */
+static int
+write_full(int fd, const uint8_t *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t ret = write(fd, data, size);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret <= 0) return 1;
+		data += ret;
+		size -= ret;
+	}
+
+	return 0;
+}
+
+/* serve_lookup: the warm entry for the given flags, replacing the least recently used one if needed */
+static struct batch_data *
+serve_lookup(struct serve_data *serve, rfcdown_extensions extensions, rfcdown_html_flags html_flags, int toc_level)
+{
+	struct serve_entry *entry = NULL, *victim = &serve->entries[0];
+	struct option_data data = *serve->data;
+	size_t i;
+
+	for (i = 0; i < SERVE_CACHE; i++) {
+		struct serve_entry *e = &serve->entries[i];
+		if (e->in_use && e->extensions == extensions && e->html_flags == html_flags && e->toc_level == toc_level) {
+			entry = e;
+			break;
+		}
+		if (victim->in_use && (!e->in_use || e->last_used < victim->last_used))
+			victim = e;
+	}
+
+	if (!entry) {
+		entry = victim;
+		if (entry->in_use) {
+			add_totals(&serve->total, &entry->batch);
+			batch_uninit(&entry->batch);
+		}
+
+		data.extensions = extensions;
+		data.html_flags = html_flags;
+		data.toc_level = toc_level;
+		batch_init(&entry->batch, &data);
+		entry->extensions = extensions;
+		entry->html_flags = html_flags;
+		entry->toc_level = toc_level;
+		entry->in_use = 1;
+	}
+
+	entry->last_used = ++serve->requests;
+	return &entry->batch;
+}
+
+/* serve_stream: answers requests read from in on out until end of input; returns the exit status */
+static int
+serve_stream(struct serve_data *serve, int in, int out)
+{
+	uint8_t header[16];
+
+	for (;;) {
+		struct batch_data *batch;
+		size_t got = read_full(in, header, sizeof header);
+		uint32_t size;
+
+		if (got == 0) return 0;
+		if (got < sizeof header) {
+			fprintf(stderr, "Truncated request header.\n");
+			return 5;
+		}
+
+		size = read_be32(header + 12);
+		if (size > SERVE_MAX_REQUEST) {
+			fprintf(stderr, "Request of %lu bytes is too large.\n", (unsigned long)size);
+			return 5;
+		}
+
+		/* waiting for the header is idle time; the payload is reading */
+		phase_start(&serve->total.times);
+		rfcdown_buffer_grow(serve->request, size);
+		if (read_full(in, serve->request->data, size) < size) {
+			fprintf(stderr, "Truncated request payload.\n");
+			return 5;
+		}
+		serve->request->size = size;
+		phase_end(&serve->total.times, PHASE_READ, size);
+
+		batch = serve_lookup(serve, read_be32(header), read_be32(header + 4), (int)read_be32(header + 8));
+		render_data(batch, serve->data, serve->request->data, serve->request->size);
+
+		phase_start(&serve->total.times);
+		write_be32(header, (uint32_t)batch->ob->size);
+		if (write_full(out, header, 4) || write_full(out, batch->ob->data, batch->ob->size)) {
+			fprintf(stderr, "I/O errors found while writing reply.\n");
+			return 5;
+		}
+		phase_end(&serve->total.times, PHASE_WRITE, batch->ob->size);
+	}
+}
+
+/* clear_socket: removes a socket file left by a server that is gone; returns nonzero if a server still answers on it */
+static int
+clear_socket(const struct sockaddr_un *addr)
+{
+	struct stat st;
+	int fd, live;
+
+	if (lstat(addr->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode))
+		return 0;
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return 0;
+	live = connect(fd, (const struct sockaddr *)addr, sizeof *addr) == 0 || errno != ECONNREFUSED;
+	close(fd);
+
+	if (!live) unlink(addr->sun_path);
+	return live;
+}
+
+/* serve_socket: accepts clients on a Unix socket, one at a time, until an error or SIGINT/SIGTERM */
+static int
+serve_socket(struct serve_data *serve, const char *path)
+{
+	struct sockaddr_un addr;
+	struct sigaction stop;
+	int fd, status = 5;
+
+	if (strlen(path) >= sizeof addr.sun_path) {
+		fprintf(stderr, "Socket path \"%s\" is too long.\n", path);
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	if (clear_socket(&addr)) {
+		fprintf(stderr, "Socket \"%s\" is in use by another server.\n", path);
+		return 5;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(fd, 16) < 0) {
+		fprintf(stderr, "Unable to listen on \"%s\": %s\n", path, strerror(errno));
+		if (fd >= 0) close(fd);
+		return 5;
+	}
+
+	/* without SA_RESTART, a signal interrupts accept and read so that the socket gets removed */
+	memset(&stop, 0, sizeof stop);
+	stop.sa_handler = serve_stop;
+	sigemptyset(&stop.sa_mask);
+	sigaction(SIGINT, &stop, NULL);
+	sigaction(SIGTERM, &stop, NULL);
+
+	while (!serve_stopped) {
+		int client = accept(fd, NULL, NULL);
+		if (client < 0) {
+			if (serve_stopped) break;
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			fprintf(stderr, "Unable to accept on \"%s\": %s\n", path, strerror(errno));
+			break;
+		}
+
+		/* a misbehaving client only loses its own connection */
+		serve_stream(serve, client, client);
+		close(client);
+	}
+
+	if (serve_stopped) status = 0;
+	close(fd);
+	unlink(path);
+	return status;
+}
+
+/* serve: runs the --serve mode, adding its totals to the given batch; returns the exit status */
+static int
+serve(struct batch_data *total, const struct option_data *data)
+{
+	struct serve_data serve;
+	size_t i;
+	int status;
+
+	memset(&serve, 0, sizeof serve);
+	totals_init(&serve.total);
+	serve.data = data;
+	serve.request = rfcdown_buffer_new(data->iunit);
+
+	/* a client hanging up must not kill the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (data->socket_path)
+		status = serve_socket(&serve, data->socket_path);
+	else
+		status = serve_stream(&serve, 0, 1);
+
+	for (i = 0; i < SERVE_CACHE; i++) {
+		if (!serve.entries[i].in_use) continue;
+		add_totals(&serve.total, &serve.entries[i].batch);
+		batch_uninit(&serve.entries[i].batch);
+	}
+	add_totals(total, &serve.total);
+
+	rfcdown_buffer_free(serve.request);
+	return status;
+}
+
+#endif
+
 int
 main(int argc, char **argv)
 {
 	struct option_data data;
-	clock_t t1, t2;
-	FILE *file = stdin;
-	rfcdown_buffer *ib, *ob;
-	rfcdown_renderer *renderer = NULL;
-	void (*renderer_free)(rfcdown_renderer *) = NULL;
-	rfcdown_document *document;
+	struct batch_data batch;
+	rfcdown_buffer *manifest;
+	double wall = -1;	/* only measured with several jobs */
+	size_t i;
 
 	/* Parse options */
 	data.basename = argv[0];
@@ -375,85 +1745,122 @@ main(int argc, char **argv)
 	data.show_time = 0;
 	data.iunit = DEF_IUNIT;
 	data.ounit = DEF_OUNIT;
-	data.filename = NULL;
+	rfcdown_stack_init(&data.filenames, 8);
+	data.files_from = NULL;
+	data.output_dir = NULL;
+	data.suffix = NULL;
 	data.renderer = RENDERER_HTML;
 	data.toc_level = 0;
 	data.html_flags = 0;
 	data.extensions = 0;
 	data.max_nesting = DEF_MAX_NESTING;
+	data.threads = 1;
+	data.jobs = 1;
+	data.cache_dir = NULL;
+	data.cache_size = DEF_CACHE_SIZE;
+	data.serve = 0;
+	data.socket_path = NULL;
+	data.watch = 0;
+	data.output = NULL;
 
 	argc = parse_options(argc, argv, parse_short_option, parse_long_option, parse_argument, &data);
 	if (data.done) return 0;
 	if (!argc) return 1;
 
-	/* Open input file, if needed */
-	if (data.filename) {
-		file = fopen(data.filename, "r");
-		if (!file) {
-			fprintf(stderr, "Unable to open input file \"%s\": %s\n", data.filename, strerror(errno));
-			return 5;
-		}
+#ifdef RFCDOWN_CACHE
+	if (data.cache_dir && mkdir(data.cache_dir, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Unable to create cache directory \"%s\": %s\n", data.cache_dir, strerror(errno));
+		return 5;
+	}
+#else
+	if (data.cache_dir) {
+		fprintf(stderr, "The --cache-dir option is not supported on this platform.\n");
+		return 1;
 	}
+#endif
 
-	/* Read everything */
-	ib = rfcdown_buffer_new(data.iunit);
+#ifndef RFCDOWN_WATCH
+	if (data.watch) {
+		fprintf(stderr, "The --watch option is not supported on this platform.\n");
+		return 1;
+	}
+#endif
 
-	if (rfcdown_buffer_putf(ib, file)) {
-		fprintf(stderr, "I/O errors found while reading input.\n");
-		return 5;
+#ifndef RFCDOWN_SERVE
+	if (data.serve) {
+		fprintf(stderr, "The --serve option is not supported on this platform.\n");
+		return 1;
 	}
+#endif
 
-	if (file != stdin) fclose(file);
+	/* Collect the input files */
+	manifest = rfcdown_buffer_new(data.iunit);
+	if (data.files_from && read_manifest(&data, manifest))
+		return 5;
+	if (data.filenames.size == 0 && !data.files_from)
+		rfcdown_stack_push(&data.filenames, NULL);
 
-	/* Create the renderer */
-	switch (data.renderer) {
-		case RENDERER_HTML:
-			renderer = rfcdown_html_renderer_new(data.html_flags, data.toc_level);
-			renderer_free = rfcdown_html_renderer_free;
-			break;
-		case RENDERER_HTML_TOC:
-			renderer = rfcdown_html_toc_renderer_new(data.toc_level);
-			renderer_free = rfcdown_html_renderer_free;
-			break;
-	};
+	if (data.watch && (data.filenames.size != 1 || !data.filenames.item[0])) {
+		fprintf(stderr, "The --watch option needs exactly one FILE.\n");
+		return 1;
+	}
 
-	/* Perform Markdown rendering */
-	ob = rfcdown_buffer_new(data.ounit);
-	document = rfcdown_document_new(renderer, data.extensions, data.max_nesting);
+	if (data.jobs > data.filenames.size)
+		data.jobs = data.filenames.size;
+
+	if (data.watch) {
+#ifdef RFCDOWN_WATCH
+		batch_init(&batch, &data);
+		batch.status = watch(&batch, &data);
+		batch_uninit(&batch);
+#endif
+	} else if (data.serve) {
+#ifdef RFCDOWN_SERVE
+		totals_init(&batch);
+		batch.status = serve(&batch, &data);
+#endif
+	} else if (data.jobs > 1) {
+		/* The workers have their own parsers; this one only collects totals.
+		 * Their phases overlap, so the wall time of the whole run is kept too. */
+		totals_init(&batch);
+		wall = now_ns();
+		run_jobs(&batch, &data, data.jobs);
+		wall = now_ns() - wall;
+	} else {
+		/* Keep going after a failed file, but report it in the exit status */
+		batch_init(&batch, &data);
+		for (i = 0; i < data.filenames.size; i++) {
+			int status = render_file(&batch, &data, data.filenames.item[i]);
+			if (status) batch.status = status;
+		}
+		batch_uninit(&batch);
+	}
 
-	t1 = clock();
-	rfcdown_document_render(document, ob, ib->data, ib->size);
-	t2 = clock();
+#ifdef RFCDOWN_CACHE
+	if (data.cache_dir)
+		cache_evict(data.cache_dir, (double)data.cache_size * (1 << 20));
+#endif
 
 	/* Cleanup */
-	rfcdown_buffer_free(ib);
-	rfcdown_document_free(document);
-	renderer_free(renderer);
-
-	/* Write the result to stdout */
-	(void)fwrite(ob->data, 1, ob->size, stdout);
-	rfcdown_buffer_free(ob);
-
-	if (ferror(stdout)) {
-		fprintf(stderr, "I/O errors found while writing output.\n");
-		return 5;
-	}
+	rfcdown_buffer_free(manifest);
+	rfcdown_stack_uninit(&data.filenames);
 
 	/* Show rendering time */
-	if (data.show_time) {
-		double elapsed;
-
-		if (t1 == ((clock_t) -1) || t2 == ((clock_t) -1)) {
-			fprintf(stderr, "Failed to get the time.\n");
-			return 1;
+	if (data.show_time == 2) {
+		print_phase_times(&batch.times, 1);
+	} else if (data.show_time) {
+		if (batch.files > 1)
+			fprintf(stderr, "Rendered %lu files, %lu bytes.\n", (unsigned long)batch.files, (unsigned long)batch.bytes);
+		if (batch.cached)
+			fprintf(stderr, "Reused %lu files from the cache.\n", (unsigned long)batch.cached);
+		fprintf(stderr, "Time spent in each phase:\n");
+		print_phase_times(&batch.times, 0);
+		if (wall >= 0) {
+			fprintf(stderr, "Wall time with %u jobs: ", data.jobs);
+			print_duration(wall);
+			fprintf(stderr, "\n");
 		}
-
-		elapsed = (double)(t2 - t1) / CLOCKS_PER_SEC;
-		if (elapsed < 1)
-			fprintf(stderr, "Time spent on rendering: %7.2f ms.\n", elapsed*1e3);
-		else
-			fprintf(stderr, "Time spent on rendering: %6.3f s.\n", elapsed);
 	}
 
-	return 0;
+	return batch.status;
 }
@@ -1,7 +1,10 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L	/* fileno, fstat, mmap */
+#endif
+
 #include "html.h"
 
 #include "common.h"
-/*#include <time.h>*/
 
 
 /* FEATURES INFO / DEFAULTS */
@@ -23,7 +26,8 @@ print_help(const char *basename)
 
 	/* main options */
 	printf("Main options:\n");
-	print_option('T', "time", "Show time spent in SmartyPants processing.");
+	print_option('T', "time", "Show time spent in each phase of SmartyPants processing, and its throughput.");
+	print_option(  0, "time-json", "Like --time, as a JSON object.");
 	print_option('i', "input-unit=N", "Reading block size. Default is " str(DEF_IUNIT) ".");
 	print_option('o', "output-unit=N", "Writing block size. Default is " str(DEF_OUNIT) ".");
 	print_option('h', "help", "Print this help text.");
@@ -45,7 +49,7 @@ struct option_data {
 	int done;
 
 	/* time reporting */
-	int show_time;
+	int show_time;	/* 2 for JSON */
 
 	/* I/O */
 	size_t iunit;
@@ -118,6 +122,11 @@ parse_long_option(char *opt, char *next, void *opaque)
 		return 1;
 	}
 
+	if (strcmp(opt, "time-json")==0) {
+		data->show_time = 2;
+		return 1;
+	}
+
 	/* FIXME: validation */
 
 	if (strcmp(opt, "input-unit")==0 && isNum) {
@@ -151,13 +160,26 @@ parse_argument(int argn, char *arg, int is_forced, void *opaque)
 
 /* MAIN LOGIC */
 
+enum phase {
+	PHASE_READ,
+	PHASE_SMARTYPANTS,
+	PHASE_WRITE,
+	PHASE_COUNT
+};
+
+static const char *const phase_names[PHASE_COUNT] = {
+	"read", "smartypants", "write"
+};
+
 int
 main(int argc, char **argv)
 {
 	struct option_data data;
-	/*struct timespec start, end;*/
+	struct phase_times times;
 	FILE *file = stdin;
+	rfcdown_html_smartypants_stream *stream;
 	rfcdown_buffer *ib, *ob;
+	int error;
 
 	/* Parse options */
 	data.basename = argv[0];
@@ -172,6 +194,7 @@ main(int argc, char **argv)
 	if (!argc) return 1;
 
 	/* Open input file, if needed */
+	phase_init(&times, phase_names, PHASE_COUNT);
 	if (data.filename) {
 		file = fopen(data.filename, "r");
 		if (!file) {
@@ -180,45 +203,50 @@ main(int argc, char **argv)
 		}
 	}
 
-	/* Read everything */
+	/* Process the input a block at a time, never holding all of it */
 	ib = rfcdown_buffer_new(data.iunit);
+	ob = rfcdown_buffer_new(data.ounit);
+	stream = rfcdown_html_smartypants_stream_new();
+	rfcdown_buffer_grow(ib, data.iunit);
 
-	while (!feof(file)) {
-		if (ferror(file)) {
-			fprintf(stderr, "I/O errors found while reading input.\n");
-			return 5;
-		}
-		rfcdown_buffer_grow(ib, ib->size + data.iunit);
-		ib->size += fread(ib->data + ib->size, 1, data.iunit, file);
-	}
-
-	if (file != stdin) fclose(file);
+	do {
+		ib->size = fread(ib->data, 1, ib->asize, file);
+		phase_end(&times, PHASE_READ, ib->size);
 
-	/* Perform SmartyPants processing */
-	ob = rfcdown_buffer_new(data.ounit);
+		if (ib->size)
+			rfcdown_html_smartypants_stream_feed(stream, ob, ib->data, ib->size);
+		else
+			rfcdown_html_smartypants_stream_finish(stream, ob);
+		phase_end(&times, PHASE_SMARTYPANTS, ib->size);
 
-	/*clock_gettime(CLOCK_MONOTONIC, &start);*/
-	rfcdown_html_smartypants(ob, ib->data, ib->size);
-	/*clock_gettime(CLOCK_MONOTONIC, &end);*/
+		(void)fwrite(ob->data, 1, ob->size, stdout);
+		phase_end(&times, PHASE_WRITE, ob->size);
+		ob->size = 0;
+	} while (ib->size);
 
-	/* Write the result to stdout */
-	(void)fwrite(ob->data, 1, ob->size, stdout);
+	error = ferror(file);
+	fflush(stdout);
+	phase_end(&times, PHASE_WRITE, 0);
 
 	/* Show rendering time */
-	if (data.show_time) {
-		/*TODO: enable this
-		long long elapsed = (end.tv_sec - start.tv_sec)*1e9 + (end.tv_nsec - start.tv_nsec);
-		if (elapsed < 1e9)
-			fprintf(stderr, "Time spent on rendering: %.2f ms.\n", ((double)elapsed)/1e6);
-		else
-			fprintf(stderr, "Time spent on rendering: %.3f s.\n", ((double)elapsed)/1e9);
-		*/
+	if (data.show_time == 2) {
+		print_phase_times(&times, 1);
+	} else if (data.show_time) {
+		fprintf(stderr, "Time spent in each phase:\n");
+		print_phase_times(&times, 0);
 	}
 
 	/* Cleanup */
+	if (file != stdin) fclose(file);
+	rfcdown_html_smartypants_stream_free(stream);
 	rfcdown_buffer_free(ib);
 	rfcdown_buffer_free(ob);
 
+	if (error) {
+		fprintf(stderr, "I/O errors found while reading input.\n");
+		return 5;
+	}
+
 	if (ferror(stdout)) {
 		fprintf(stderr, "I/O errors found while writing output.\n");
 		return 5;
@@ -0,0 +1,173 @@
+#!/usr/bin/env python
+# Generates src/html_smartypants_subs.h, the automaton SmartyPants uses to
+# recognize every substitution below in one step per byte:
+#
+#   python html_smartypants_subs.py > src/html_smartypants_subs.h
+#
+# Each entry is (pattern, consume, kind, replacement, flags):
+#
+#   pattern      bytes to match; letters match either case with ICASE
+#   consume      bytes replaced, which can be fewer than the pattern
+#   kind         SUB puts the replacement (possibly nothing) where
+#                SmartyPants triggers, CONTRACTION right after a single
+#                quote; SQUOTE and DQUOTE are quotes for the quoting logic
+#   flags        BEFORE wants a word boundary before the pattern,
+#                AFTER one (or the end of the text) after it
+#
+# All patterns share one automaton. Where several match, the longest one
+# whose conditions hold wins.
+
+import sys
+
+ICASE, BEFORE, AFTER = 1, 2, 4
+
+SUBS = [
+    # dashes and ellipses
+    ('---', 3, 'SUB', '&mdash;', 0),
+    ('--', 2, 'SUB', '&ndash;', 0),
+    ('...', 3, 'SUB', '&hellip;', 0),
+    ('. . .', 5, 'SUB', '&hellip;', 0),
+
+    # symbols
+    ('(c)', 3, 'SUB', '&copy;', ICASE),
+    ('(r)', 3, 'SUB', '&reg;', ICASE),
+    ('(tm)', 4, 'SUB', '&trade;', ICASE),
+
+    # fractions
+    ('1/2', 3, 'SUB', '&frac12;', BEFORE | AFTER),
+    ('1/4', 3, 'SUB', '&frac14;', BEFORE | AFTER),
+    ('1/4th', 3, 'SUB', '&frac14;', BEFORE | ICASE),
+    ('3/4', 3, 'SUB', '&frac34;', BEFORE | AFTER),
+    ('3/4ths', 3, 'SUB', '&frac34;', BEFORE | ICASE),
+
+    # entities: quotes are handed over, a null character is dropped
+    ("'", 1, 'SQUOTE', '', 0),
+    ('&#39;', 5, 'SQUOTE', '', 0),
+    ('&#x27;', 6, 'SQUOTE', '', 0),
+    ('&apos;', 6, 'SQUOTE', '', 0),
+    ('&quot;', 6, 'DQUOTE', '', 0),
+    ('&#0;', 4, 'SUB', '', 0),
+
+    # contractions: Tom's, isn't, I'm, I'd, you're, you'll, you've
+    ('s', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('t', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('m', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('d', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('re', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('ll', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+    ('ve', 0, 'CONTRACTION', '&rsquo;', AFTER | ICASE),
+]
+
+
+def build():
+    # state 0 is dead, 1 is the root
+    trans = [{}, {}]
+    accept = [0, 0]
+    folded = [set(), set()]     # bytes of a state matched in either case
+
+    for index, (pattern, consume, kind, repl, flags) in enumerate(SUBS):
+        state = 1
+        for ch in pattern:
+            keys = [ch]
+            if flags & ICASE and ch.isalpha():
+                keys = [ch.lower(), ch.upper()]
+            elif ch.lower() in folded[state] or ch.upper() in folded[state]:
+                sys.exit("pattern %r needs a case the others ignore" % pattern)
+
+            nxt = trans[state].get(keys[0])
+            if nxt is None:
+                nxt = len(trans)
+                trans.append({})
+                accept.append(0)
+                folded.append(set())
+            for key in keys:
+                if trans[state].get(key, nxt) != nxt:
+                    sys.exit("pattern %r needs a case the others ignore" % pattern)
+                trans[state][key] = nxt
+            if len(keys) > 1:
+                folded[state].update(keys)
+            state = nxt
+
+        if accept[state]:
+            sys.exit("pattern %r is there twice" % pattern)
+        accept[state] = index + 1
+
+    # the accepting state of the longest shorter match on the way to each state
+    shorter = [0] * len(trans)
+    todo = [1]
+    while todo:
+        state = todo.pop()
+        for nxt in set(trans[state].values()):
+            shorter[nxt] = state if accept[state] else shorter[state]
+            todo.append(nxt)
+
+    return trans, accept, shorter
+
+
+def main():
+    trans, accept, shorter = build()
+
+    # bytes that no pattern tells apart share a class; class 0 matches nothing
+    columns = {}
+    classes = [0] * 256
+    for byte in range(256):
+        column = tuple(t.get(chr(byte), 0) for t in trans)
+        if any(column):
+            classes[byte] = columns.setdefault(column, len(columns) + 1)
+
+    if len(trans) > 255 or len(columns) > 255:
+        sys.exit("too many states for uint8_t")
+
+    out = sys.stdout.write
+    out("/* Generated by html_smartypants_subs.py from its table; do not edit. */\n\n")
+
+    out("enum smartypants_sub_kind {\n\tSMARTYPANTS_SUB,\n\tSMARTYPANTS_CONTRACTION,\n\tSMARTYPANTS_SQUOTE,\n\tSMARTYPANTS_DQUOTE\n};\n\n")
+    out("#define SMARTYPANTS_BEFORE 1\n#define SMARTYPANTS_AFTER 2\n\n")
+
+    out("struct smartypants_sub {\n")
+    out("\tuint8_t length;\t\t/* bytes matched */\n")
+    out("\tuint8_t consume;\t/* bytes replaced */\n")
+    out("\tuint8_t kind;\n")
+    out("\tuint8_t flags;\n")
+    out("\tconst char *replacement;\n")
+    out("};\n\n")
+
+    out("static const struct smartypants_sub smartypants_subs[] = {\n")
+    for pattern, consume, kind, repl, flags in SUBS:
+        cond = []
+        if flags & BEFORE:
+            cond.append("SMARTYPANTS_BEFORE")
+        if flags & AFTER:
+            cond.append("SMARTYPANTS_AFTER")
+        out("\t{%d, %d, SMARTYPANTS_%s, %s, \"%s\"},\t/* %s */\n" % (
+            len(pattern), consume, kind, "|".join(cond) or "0", repl,
+            pattern.replace("*/", "*\\/")))
+    out("};\n\n")
+
+    out("static const uint8_t smartypants_class[UINT8_MAX+1] = {\n")
+    for row in range(16):
+        out("\t" + ", ".join(str(c) for c in classes[row * 16:row * 16 + 16]) + ",\n")
+    out("};\n\n")
+
+    order = sorted(columns.items(), key=lambda item: item[1])
+    out("static const uint8_t smartypants_next[%d][%d] = {\n" % (len(trans), len(columns) + 1))
+    for state in range(len(trans)):
+        row = [0] + [column[state] for column, _ in order]
+        out("\t{" + ", ".join(str(n) for n in row) + "},\n")
+    out("};\n\n")
+
+    out("/* 1 + index in smartypants_subs of the pattern ending there, or 0 */\n")
+    out("static const uint8_t smartypants_accept[%d] = {\n" % len(trans))
+    for row in range(0, len(accept), 16):
+        out("\t" + ", ".join(str(a) for a in accept[row:row + 16]) + ",\n")
+    out("};\n\n")
+
+    out("/* where the longest shorter pattern on the way there ends, or 0 */\n")
+    out("static const uint8_t smartypants_shorter[%d] = {\n" % len(trans))
+    for row in range(0, len(shorter), 16):
+        out("\t" + ", ".join(str(a) for a in shorter[row:row + 16]) + ",\n")
+    out("};\n")
+
+
+if __name__ == '__main__':
+    main()
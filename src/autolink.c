@@ -3,7 +3,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
+
+#include "chars.h"
 
 #ifndef _MSC_VER
 #include <strings.h>
@@ -11,6 +12,39 @@
 #define strncasecmp	_strnicmp
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* classes of the bytes the forward scan cares about */
+#define AL_ALPHA	1	/* letters, as in a scheme */
+#define AL_DIGIT	2
+#define AL_LOCAL	4	/* ".+-_" and NUL, allowed with alnums before '@' */
+#define AL_SPACE	8
+#define AL_ANCHOR	16	/* ':', '@' and '.', where a link shows itself */
+#define AL_BOUNDARY	32	/* punctuation or space: a word may start after it */
+
+#define AL_ALNUM	(AL_ALPHA | AL_DIGIT)
+
+static const uint8_t autolink_chars[UINT8_MAX+1] = {
+	4, 0, 0, 0, 0, 0, 0, 0, 0, 40, 40, 40, 40, 40, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	40, 32, 32, 32, 32, 32, 32, 32, 32, 32, 32, 36, 32, 36, 52, 32,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 48, 32, 32, 32, 32, 32,
+	48, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 32, 32, 32, 32, 36,
+	32, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 32, 32, 32, 32, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
 int
 rfcdown_autolink_is_safe(const uint8_t *data, size_t size)
 {
@@ -26,121 +60,356 @@ rfcdown_autolink_is_safe(const uint8_t *data, size_t size)
 
 		if (size > len &&
 			strncasecmp((char *)data, valid_uris[i], len) == 0 &&
-			isalnum(data[len]))
+			rfcdown_isalnum(data[len]))
 			return 1;
 	}
 
 	return 0;
 }
 
+/* autolink_end • scans a link from data[i], where its domain starts, to the
+ * first space or '<', and returns where it ends without its trailing
+ * punctuation. Trailing "?!.,:" or NUL is left out, and so is a trailing ';' or a
+ * whole entity like "&quot;"; then a closing quote or bracket is too, unless
+ * it closes one opened in the link:
+ *
+ *	foo http://www.pokemon.com/Pikachu_(Electric) bar
+ *		=> http://www.pokemon.com/Pikachu_(Electric)
+ *
+ *	foo (http://www.pokemon.com/Pikachu_(Electric)) bar
+ *		=> http://www.pokemon.com/Pikachu_(Electric)
+ *
+ *	foo http://www.pokemon.com/Pikachu_(Electric)) bar
+ *		=> http://www.pokemon.com/Pikachu_(Electric))
+ *
+ *	(foo http://www.pokemon.com/Pikachu_(Electric)) bar
+ *		=> foo http://www.pokemon.com/Pikachu_(Electric)
+ *
+ * Each byte is read once: the end is kept up to date as the scan goes, with
+ * the end as it was before the last '&' in case an entity follows. The dots
+ * of the domain, but for one at the very end of data, are counted in *dots,
+ * with its colons and NULs as the strchr() checks before this scan did. */
 static size_t
-autolink_delim(uint8_t *data, size_t link_end, size_t max_rewind, size_t size)
+autolink_end(const uint8_t *data, size_t i, size_t size, size_t *dots)
 {
-	uint8_t cclose, copen = 0;
-	size_t i;
+	size_t end = i, amp_end = i;
+	size_t parens = 0, brackets = 0, braces = 0;
+	int drop = 0, amp_drop = 0;
+	int entity = 0;	/* 1 + letters since a '&', or 0 */
+	int domain = 1;
+
+	*dots = 0;
 
-	for (i = 0; i < link_end; ++i)
-		if (data[i] == '<') {
-			link_end = i;
+	for (; i < size; i++) {
+		uint8_t c = data[i];
+
+		if (c == '<' || (autolink_chars[c] & AL_SPACE))
 			break;
+
+		if (domain) {
+			if (c == '.' || c == ':' || c == '\0') {
+				if (i + 1 < size)
+					(*dots)++;
+			} else if (!(autolink_chars[c] & AL_ALNUM) && c != '-')
+				domain = 0;
 		}
 
-	while (link_end > 0) {
-		if (strchr("?!.,:", data[link_end - 1]) != NULL)
-			link_end--;
+		switch (c) {
+		case '?': case '!': case '.': case ',': case ':': case '\0':
+			entity = 0;
+			continue;
+
+		case ';':
+			if (entity > 1) {
+				end = amp_end;
+				drop = amp_drop;
+			}
+			entity = 0;
+			continue;
 
-		else if (data[link_end - 1] == ';') {
-			size_t new_end = link_end - 2;
+		case '&':
+			amp_end = end;
+			amp_drop = drop;
+			entity = 1;
+			drop = 0;
+			break;
 
-			while (new_end > 0 && isalpha(data[new_end]))
-				new_end--;
+		case '(': parens++; drop = 0; break;
+		case '[': brackets++; drop = 0; break;
+		case '{': braces++; drop = 0; break;
+		case ')': parens--; drop = (parens != 0); break;
+		case ']': brackets--; drop = (brackets != 0); break;
+		case '}': braces--; drop = (braces != 0); break;
 
-			if (new_end < link_end - 2 && data[new_end] == '&')
-				link_end = new_end;
-			else
-				link_end--;
+		/* quotes open and close alike: one at the end never closes */
+		case '"': case '\'': drop = 1; break;
+
+		default:
+			drop = 0;
 		}
-		else break;
+
+		if (c != '&')
+			entity = (entity && (autolink_chars[c] & AL_ALPHA)) ? entity + 1 : 0;
+		end = i + 1;
 	}
 
-	if (link_end == 0)
+	return end - drop;
+}
+
+/* autolink_url • recognizes a URL whose scheme is data[0..scheme) */
+static size_t
+autolink_url(const uint8_t *data, size_t scheme, size_t size, unsigned int flags)
+{
+	size_t end, dots;
+
+	if (!((scheme == 4 && strncasecmp((const char *)data, "http", 4) == 0) ||
+		(scheme == 5 && strncasecmp((const char *)data, "https", 5) == 0) ||
+		(scheme == 3 && strncasecmp((const char *)data, "ftp", 3) == 0)))
 		return 0;
 
-	cclose = data[link_end - 1];
+	if (size <= scheme + 3 ||
+		memcmp(data + scheme, "://", 3) != 0 ||
+		!(autolink_chars[data[scheme + 3]] & AL_ALNUM))
+		return 0;
 
-	switch (cclose) {
-	case '"':	copen = '"'; break;
-	case '\'':	copen = '\''; break;
-	case ')':	copen = '('; break;
-	case ']':	copen = '['; break;
-	case '}':	copen = '{'; break;
-	}
+	end = autolink_end(data, scheme + 3, size, &dots);
 
-	if (copen != 0) {
-		size_t closing = 0;
-		size_t opening = 0;
-		size_t i = 0;
-
-		/* Try to close the final punctuation sign in this same line;
-		 * if we managed to close it outside of the URL, that means that it's
-		 * not part of the URL. If it closes inside the URL, that means it
-		 * is part of the URL.
-		 *
-		 * Examples:
-		 *
-		 *	foo http://www.pokemon.com/Pikachu_(Electric) bar
-		 *		=> http://www.pokemon.com/Pikachu_(Electric)
-		 *
-		 *	foo (http://www.pokemon.com/Pikachu_(Electric)) bar
-		 *		=> http://www.pokemon.com/Pikachu_(Electric)
-		 *
-		 *	foo http://www.pokemon.com/Pikachu_(Electric)) bar
-		 *		=> http://www.pokemon.com/Pikachu_(Electric))
-		 *
-		 *	(foo http://www.pokemon.com/Pikachu_(Electric)) bar
-		 *		=> foo http://www.pokemon.com/Pikachu_(Electric)
-		 */
-
-		while (i < link_end) {
-			if (data[i] == copen)
-				opening++;
-			else if (data[i] == cclose)
-				closing++;
-
-			i++;
-		}
+	if (!dots && !(flags & RFCDOWN_AUTOLINK_SHORT_DOMAINS))
+		return 0;
 
-		if (closing != opening)
-			link_end--;
-	}
+	return end;
+}
 
-	return link_end;
+/* autolink_www • recognizes a link starting with "www." */
+static size_t
+autolink_www(const uint8_t *data, size_t size)
+{
+	size_t end, dots;
+
+	if (size < 4 || memcmp(data, "www.", 4) != 0)
+		return 0;
+
+	end = autolink_end(data, 0, size, &dots);
+
+	return dots ? end : 0;
 }
 
+/* autolink_email • recognizes an address whose '@' is data[at] */
 static size_t
-check_domain(uint8_t *data, size_t size, int allow_short)
+autolink_email(const uint8_t *data, size_t at, size_t size)
+{
+	size_t i;
+	int nb = 0, np = 0;
+
+	for (i = at; i < size; ++i) {
+		uint8_t c = data[i];
+
+		if (autolink_chars[c] & AL_ALNUM)
+			continue;
+
+		if (c == '@')
+			nb++;
+		else if (c == '.' && i < size - 1)
+			np++;
+		else if (c != '-' && c != '_')
+			break;
+	}
+
+	if (i - at < 2 || nb != 1 || np == 0 ||
+		!(autolink_chars[data[i - 1]] & AL_ALPHA))
+		return 0;
+
+	return i;
+}
+
+void
+rfcdown_autolink_scanner_init(rfcdown_autolink_scanner *scan, unsigned int kinds, rfcdown_autolink_flags flags)
 {
-	size_t i, np = 0;
+	scan->kinds = kinds;
+	scan->flags = flags;
+	scan->found = 0;
+	rfcdown_autolink_restart(scan, 0);
+}
 
-	if (!isalnum(data[0]))
+void
+rfcdown_autolink_restart(rfcdown_autolink_scanner *scan, size_t pos)
+{
+	scan->scheme = pos;
+	scan->local = pos;
+	scan->last = ' ';	/* as if after a space */
+}
+
+/*
+ * SSE2 prefilter: a block of up to 16 bytes where no "://", '@' or "www."
+ * could end only moves where the words under scan began. Returns the size
+ * of the block, or 0 if the bytes have to go one by one. It reads the 3
+ * bytes before data[pos] and 18 from there on.
+ */
+#if defined(__SSE2__)
+static size_t
+autolink_block_sse2(const uint8_t *data, size_t pos, size_t end, size_t *scheme, size_t *local, uint32_t *last)
+{
+	const uint8_t *p = data + pos;
+	const __m128i w = _mm_set1_epi8('w');
+	const __m128i slash = _mm_set1_epi8('/');
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i found, www, alpha, digit, word;
+	size_t len = end - pos < 16 ? end - pos : 16, i;
+	unsigned int in_block = (1u << len) - 1, mask;
+
+	found = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+		_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 1)), slash),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + 2)), slash)));
+	found = _mm_or_si128(found, _mm_cmpeq_epi8(v, _mm_set1_epi8('@')));
+	www = _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('.')),
+		_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p - 1)), w));
+	www = _mm_and_si128(www,
+		_mm_and_si128(
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p - 2)), w),
+			_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p - 3)), w)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(found, www)) & in_block)
 		return 0;
 
-	for (i = 1; i < size - 1; ++i) {
-		if (strchr(".:", data[i]) != NULL) np++;
-		else if (!isalnum(data[i]) && data[i] != '-') break;
+	/* letters are 'a' to 'z' once 0x20 is set, digits '0' to '9' */
+	alpha = _mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+	alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(25)), alpha);
+	digit = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+	digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+	word = _mm_or_si128(alpha, digit);
+	word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+	word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+	word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+	word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+	word = _mm_or_si128(word, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+	/* the letters, and the address, begin after the last byte outside them */
+	mask = ~(unsigned int)_mm_movemask_epi8(alpha) & in_block;
+	if (mask)
+		*scheme = pos + 32 - __builtin_clz(mask);
+	mask = ~(unsigned int)_mm_movemask_epi8(word) & in_block;
+	if (mask)
+		*local = pos + 32 - __builtin_clz(mask);
+
+	for (i = len < 4 ? 0 : len - 4; i < len; i++)
+		*last = (*last << 8) | p[i];
+
+	return len;
+}
+#endif
+
+size_t
+rfcdown_autolink_next(
+	rfcdown_autolink_scanner *scan,
+	size_t *link_size,
+	const uint8_t *data,
+	size_t pos,
+	size_t end,
+	size_t size)
+{
+	size_t scheme = scan->scheme, local = scan->local;
+	uint32_t last = scan->last;
+	size_t start = 0, n = 0;
+#if defined(__SSE2__)
+	size_t block = pos, skip;
+#endif
+
+	for (; pos < end; pos++) {
+		uint8_t c;
+		uint8_t cls;
+
+#if defined(__SSE2__)
+		/* skip whole blocks while they have nothing for the
+		 * recognizers; take the next 16 bytes one by one */
+		if (pos >= block) {
+			while (pos >= 3 && pos < end && pos + 18 <= size &&
+				(skip = autolink_block_sse2(data, pos, end, &scheme, &local, &last)) > 0)
+				pos += skip;
+			block = pos + 16;
+			if (pos >= end)
+				break;
+		}
+#endif
+
+		c = data[pos];
+		cls = autolink_chars[c];
+
+		/* a link can only show at an anchor; the scan knows where
+		 * it would have started by then */
+		if (cls & AL_ANCHOR) {
+			if (c == ':') {
+				start = scheme;
+				if ((scan->kinds & RFCDOWN_AUTOLINK_KIND_URL) &&
+					pos - start >= 3 && pos - start <= 5 &&
+					pos + 2 < size && data[pos + 1] == '/')
+					n = autolink_url(data + start, pos - start, size - start, scan->flags);
+				if (n) {
+					scan->found = RFCDOWN_AUTOLINK_KIND_URL;
+					break;
+				}
+			} else if (c == '@') {
+				start = local;
+				if ((scan->kinds & RFCDOWN_AUTOLINK_KIND_EMAIL) && pos > start)
+					n = autolink_email(data + start, pos - start, size - start);
+				if (n) {
+					scan->found = RFCDOWN_AUTOLINK_KIND_EMAIL;
+					break;
+				}
+			} else if ((last & 0xffffff) == 0x777777 &&
+				(autolink_chars[last >> 24] & AL_BOUNDARY)) {
+				start = pos - 3;
+				if (scan->kinds & RFCDOWN_AUTOLINK_KIND_WWW)
+					n = autolink_www(data + start, size - start);
+				if (n) {
+					scan->found = RFCDOWN_AUTOLINK_KIND_WWW;
+					break;
+				}
+			}
+		}
+
+		/* everything else only moves where the word under scan began */
+		scheme = (cls & AL_ALPHA) ? scheme : pos + 1;
+		local = (cls & (AL_ALNUM | AL_LOCAL)) ? local : pos + 1;
+		last = (last << 8) | c;
 	}
 
-	if (allow_short) {
-		/* We don't need a valid domain in the strict sense (with
-		 * least one dot; so just make sure it's composed of valid
-		 * domain characters and return the length of the the valid
-		 * sequence. */
-		return i;
-	} else {
-		/* a valid domain needs to have at least a dot.
-		 * that's as far as we get */
-		return np ? i : 0;
+	scan->scheme = scheme;
+	scan->local = local;
+	scan->last = last;
+	*link_size = n;
+
+	return n ? start : end;
+}
+
+size_t
+rfcdown_autolink_scan(
+	const uint8_t *data,
+	size_t size,
+	rfcdown_autolink_flags flags,
+	rfcdown_autolink_callback callback,
+	void *opaque)
+{
+	rfcdown_autolink_scanner scan;
+	size_t pos = 0, start, link_size, count = 0;
+
+	rfcdown_autolink_scanner_init(&scan, RFCDOWN_AUTOLINK_KIND_URL |
+		RFCDOWN_AUTOLINK_KIND_WWW | RFCDOWN_AUTOLINK_KIND_EMAIL, flags);
+
+	while (pos < size) {
+		start = rfcdown_autolink_next(&scan, &link_size, data, pos, size, size);
+		if (!link_size)
+			break;
+
+		if (callback)
+			callback(opaque, scan.found, start, link_size);
+		count++;
+
+		pos = start + link_size;
+		rfcdown_autolink_restart(&scan, pos);
 	}
+
+	return count;
 }
 
 size_t
@@ -154,21 +423,10 @@ rfcdown_autolink__www(
 {
 	size_t link_end;
 
-	if (max_rewind > 0 && !ispunct(data[-1]) && !isspace(data[-1]))
-		return 0;
-
-	if (size < 4 || memcmp(data, "www.", strlen("www.")) != 0)
+	if (max_rewind > 0 && !rfcdown_ispunct(data[-1]) && !rfcdown_isspace(data[-1]))
 		return 0;
 
-	link_end = check_domain(data, size, 0);
-
-	if (link_end == 0)
-		return 0;
-
-	while (link_end < size && !isspace(data[link_end]))
-		link_end++;
-
-	link_end = autolink_delim(data, link_end, max_rewind, size);
+	link_end = autolink_www(data, size);
 
 	if (link_end == 0)
 		return 0;
@@ -176,7 +434,7 @@ rfcdown_autolink__www(
 	rfcdown_buffer_put(link, data, link_end);
 	*rewind_p = 0;
 
-	return (int)link_end;
+	return link_end;
 }
 
 size_t
@@ -189,50 +447,24 @@ rfcdown_autolink__email(
 	unsigned int flags)
 {
 	size_t link_end, rewind;
-	int nb = 0, np = 0;
 
 	for (rewind = 0; rewind < max_rewind; ++rewind) {
-		uint8_t c = data[-1 - rewind];
-
-		if (isalnum(c))
-			continue;
-
-		if (strchr(".+-_", c) != NULL)
-			continue;
-
-		break;
-	}
-
-	if (rewind == 0)
-		return 0;
-
-	for (link_end = 0; link_end < size; ++link_end) {
-		uint8_t c = data[link_end];
-
-		if (isalnum(c))
-			continue;
-
-		if (c == '@')
-			nb++;
-		else if (c == '.' && link_end < size - 1)
-			np++;
-		else if (c != '-' && c != '_')
+		if (!(autolink_chars[data[-1 - rewind]] & (AL_ALNUM | AL_LOCAL)))
 			break;
 	}
 
-	if (link_end < 2 || nb != 1 || np == 0 ||
-		!isalpha(data[link_end - 1]))
+	if (rewind == 0)
 		return 0;
 
-	link_end = autolink_delim(data, link_end, max_rewind, size);
+	link_end = autolink_email(data - rewind, rewind, size + rewind);
 
 	if (link_end == 0)
 		return 0;
 
-	rfcdown_buffer_put(link, data - rewind, link_end + rewind);
+	rfcdown_buffer_put(link, data - rewind, link_end);
 	*rewind_p = rewind;
 
-	return link_end;
+	return link_end - rewind;
 }
 
 size_t
@@ -244,38 +476,18 @@ rfcdown_autolink__url(
 	size_t size,
 	unsigned int flags)
 {
-	size_t link_end, rewind = 0, domain_len;
+	size_t link_end, rewind = 0;
 
-	if (size < 4 || data[1] != '/' || data[2] != '/')
-		return 0;
-
-	while (rewind < max_rewind && isalpha(data[-1 - rewind]))
+	while (rewind < max_rewind && rfcdown_isalpha(data[-1 - rewind]))
 		rewind++;
 
-	if (!rfcdown_autolink_is_safe(data - rewind, size + rewind))
-		return 0;
-
-	link_end = strlen("://");
-
-	domain_len = check_domain(
-		data + link_end,
-		size - link_end,
-		flags & RFCDOWN_AUTOLINK_SHORT_DOMAINS);
-
-	if (domain_len == 0)
-		return 0;
-
-	link_end += domain_len;
-	while (link_end < size && !isspace(data[link_end]))
-		link_end++;
-
-	link_end = autolink_delim(data, link_end, max_rewind, size);
+	link_end = autolink_url(data - rewind, rewind, size + rewind, flags);
 
 	if (link_end == 0)
 		return 0;
 
-	rfcdown_buffer_put(link, data - rewind, link_end + rewind);
+	rfcdown_buffer_put(link, data - rewind, link_end);
 	*rewind_p = rewind;
 
-	return link_end;
+	return link_end - rewind;
 }
@@ -18,6 +18,33 @@ typedef enum rfcdown_autolink_flags {
 	RFCDOWN_AUTOLINK_SHORT_DOMAINS = (1 << 0)
 } rfcdown_autolink_flags;
 
+typedef enum rfcdown_autolink_kind {
+	RFCDOWN_AUTOLINK_KIND_URL = (1 << 0),	/* http://, https:// or ftp:// */
+	RFCDOWN_AUTOLINK_KIND_WWW = (1 << 1),	/* www. without a scheme */
+	RFCDOWN_AUTOLINK_KIND_EMAIL = (1 << 2)	/* an address with an '@' */
+} rfcdown_autolink_kind;
+
+
+/*********
+ * TYPES *
+ *********/
+
+/* rfcdown_autolink_callback: gets each link found in data[start..start+size) */
+typedef void (*rfcdown_autolink_callback)(void *opaque,
+	rfcdown_autolink_kind kind, size_t start, size_t size);
+
+/* rfcdown_autolink_scanner: a forward scan for links */
+struct rfcdown_autolink_scanner {
+	unsigned int kinds;	/* the rfcdown_autolink_kind to look for */
+	rfcdown_autolink_flags flags;
+	rfcdown_autolink_kind found;	/* kind of the last link found */
+
+	size_t scheme;	/* where the letters under scan began */
+	size_t local;	/* where the address under scan began */
+	uint32_t last;	/* the last four bytes scanned */
+};
+typedef struct rfcdown_autolink_scanner rfcdown_autolink_scanner;
+
 
 /*************
  * FUNCTIONS *
@@ -26,6 +53,28 @@ typedef enum rfcdown_autolink_flags {
 /* rfcdown_autolink_is_safe: verify that a URL has a safe protocol */
 int rfcdown_autolink_is_safe(const uint8_t *data, size_t size);
 
+/* rfcdown_autolink_scanner_init: prepare a scan for the given kinds of links */
+void rfcdown_autolink_scanner_init(rfcdown_autolink_scanner *scan,
+	unsigned int kinds, rfcdown_autolink_flags flags);
+
+/* rfcdown_autolink_restart: start over at data[pos], as if at a word start */
+void rfcdown_autolink_restart(rfcdown_autolink_scanner *scan, size_t pos);
+
+/* rfcdown_autolink_next: scan data[pos..end) for the next link, reading each
+ * byte once, and return where it starts, with its size in *link_size and
+ * its kind in scan->found; the link itself may run on up to data[size].
+ * Returns end, with *link_size 0, if there is none: the scan goes on from
+ * there with the next call. */
+size_t rfcdown_autolink_next(rfcdown_autolink_scanner *scan, size_t *link_size,
+	const uint8_t *data, size_t pos, size_t end, size_t size);
+
+/* rfcdown_autolink_scan: find every link in plain text, in one pass, and
+ * return how many there are. A link never spans a space or a '<', and the
+ * text after it is scanned anew; callback can be NULL to only count them. */
+size_t rfcdown_autolink_scan(const uint8_t *data, size_t size,
+	rfcdown_autolink_flags flags, rfcdown_autolink_callback callback,
+	void *opaque);
+
 /* rfcdown_autolink__www: search for the next www link in data */
 size_t rfcdown_autolink__www(size_t *rewind_p, rfcdown_buffer *link,
 	uint8_t *data, size_t offset, size_t size, rfcdown_autolink_flags flags);
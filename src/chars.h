@@ -0,0 +1,53 @@
+/* chars.h - locale-independent character classes */
+
+#ifndef RFCDOWN_CHARS_H
+#define RFCDOWN_CHARS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*************
+ * CONSTANTS *
+ *************/
+
+/* classes of an ASCII byte, as <ctype.h> has them in the "C" locale;
+ * bytes above 0x7f are in none of them */
+#define RFCDOWN_CHAR_DIGIT	1
+#define RFCDOWN_CHAR_ALPHA	2
+#define RFCDOWN_CHAR_SPACE	4	/* ' ', '\t', '\n', '\v', '\f' and '\r' */
+#define RFCDOWN_CHAR_PUNCT	8
+#define RFCDOWN_CHAR_XDIGIT	16
+#define RFCDOWN_CHAR_UPPER	32	/* the bit that makes the letter lowercase */
+
+#define RFCDOWN_CHAR_ALNUM	(RFCDOWN_CHAR_ALPHA | RFCDOWN_CHAR_DIGIT)
+
+extern const uint8_t rfcdown_chars[UINT8_MAX+1];
+
+
+/*************
+ * FUNCTIONS *
+ *************/
+
+/* rfcdown_is*: class tests on a byte, whatever LC_CTYPE is set to */
+#define rfcdown_ischar(c, cls)	(rfcdown_chars[(uint8_t)(c)] & (cls))
+#define rfcdown_isdigit(c)	rfcdown_ischar(c, RFCDOWN_CHAR_DIGIT)
+#define rfcdown_isalpha(c)	rfcdown_ischar(c, RFCDOWN_CHAR_ALPHA)
+#define rfcdown_isalnum(c)	rfcdown_ischar(c, RFCDOWN_CHAR_ALNUM)
+#define rfcdown_isspace(c)	rfcdown_ischar(c, RFCDOWN_CHAR_SPACE)
+#define rfcdown_ispunct(c)	rfcdown_ischar(c, RFCDOWN_CHAR_PUNCT)
+#define rfcdown_isxdigit(c)	rfcdown_ischar(c, RFCDOWN_CHAR_XDIGIT)
+#define rfcdown_isupper(c)	rfcdown_ischar(c, RFCDOWN_CHAR_UPPER)
+
+/* rfcdown_tolower: an ASCII letter in lowercase, any other byte as is */
+#define rfcdown_tolower(c)	((uint8_t)(c) | rfcdown_ischar(c, RFCDOWN_CHAR_UPPER))
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /** RFCDOWN_CHARS_H **/
@@ -2,9 +2,9 @@
 
 #include <assert.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdio.h>
 
+#include "chars.h"
 #include "stack.h"
 
 #ifndef _MSC_VER
@@ -13,6 +13,15 @@
 #define strncasecmp	_strnicmp
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#ifndef _WIN32
+#include <pthread.h>
+#define RFCDOWN_THREADS
+#endif
+
 #define REF_TABLE_SIZE 8
 
 #define BUFFER_BLOCK 0
@@ -20,8 +29,20 @@
 
 #define RFCDOWN_LI_END 8	/* internal list flag */
 
+#define DEFAULT_RETENTION (1024 * 1024)	/* bytes kept warm between renders */
+#define PARALLEL_MIN_CHUNK (16 * 1024)	/* smallest chunk worth a thread */
+
 const char *rfcdown_find_block_tag(const char *str, unsigned int len);
 
+/* DOC_EXT: extensions in effect; when this file is compiled as the
+ * specialized parser (RFCDOWN_SPEC_ONLY), they are a compile-time
+ * constant and the branches for disabled extensions fold away */
+#ifdef RFCDOWN_SPEC_ONLY
+#define DOC_EXT(doc) ((rfcdown_extensions)(RFCDOWN_SPEC_EXT))
+#else
+#define DOC_EXT(doc) ((doc)->ext_flags)
+#endif
+
 /***************
  * LOCAL TYPES *
  ***************/
@@ -31,7 +52,9 @@ struct link_ref {
 	unsigned int id;
 
 	rfcdown_buffer *link;
-	rfcdown_buffer *title;
+	rfcdown_buffer *title;	/* title_buf when the reference has a title */
+	rfcdown_buffer *title_buf;
+	rfcdown_buffer *href_memo;
 
 	struct link_ref *next;
 };
@@ -59,12 +82,36 @@ struct footnote_list {
 	struct footnote_item *tail;
 };
 
-/* char_trigger: function pointer to render active chars */
-/*   returns the number of chars taken care of */
-/*   data is the pointer of the beginning of the span */
-/*   offset is the number of valid chars before data */
-typedef size_t
-(*char_trigger)(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
+/* code_run: a run of backticks in an inline span */
+struct code_run {
+	size_t start;
+	size_t size;
+	size_t longest;	/* size of the longest run from this one to the end */
+};
+
+/* span_index: what the inline parser keeps about an inline span while it
+ * parses it, each part worked out the first time it is needed */
+struct span_index {
+	const uint8_t *data;
+	size_t size;
+
+	/* backtick runs, listed in doc->code_runs */
+	int code_listed;
+	size_t code_first;	/* index of its first run in doc->code_runs */
+	size_t code_count;
+	size_t code_next;	/* the first run that does not end before the last opener */
+
+	/* the last closing "$" and "$$" found, and from where they were looked
+	 * for: no other can be found before them */
+	int math_ready;
+	size_t dollar_from, dollar_at;
+	size_t double_from, double_at;
+	size_t text_end;	/* only spaces from there on */
+	size_t blank_from, blank_end;	/* only spaces between the two */
+
+	/* the last '>' found, and from where */
+	size_t angle_from, angle_at;
+};
 
 static size_t char_emphasis(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_quote(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
@@ -73,9 +120,6 @@ static size_t char_codespan(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *
 static size_t char_escape(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_entity(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_langle_tag(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
-static size_t char_autolink_url(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
-static size_t char_autolink_email(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
-static size_t char_autolink_www(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_superscript(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
 static size_t char_math(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size);
@@ -89,43 +133,60 @@ enum markdown_char_t {
 	MD_CHAR_LANGLE,
 	MD_CHAR_ESCAPE,
 	MD_CHAR_ENTITY,
-	MD_CHAR_AUTOLINK_URL,
-	MD_CHAR_AUTOLINK_EMAIL,
-	MD_CHAR_AUTOLINK_WWW,
 	MD_CHAR_SUPERSCRIPT,
 	MD_CHAR_QUOTE,
 	MD_CHAR_MATH
 };
 
-static char_trigger markdown_char_ptrs[] = {
-	NULL,
-	&char_emphasis,
-	&char_codespan,
-	&char_linebreak,
-	&char_link,
-	&char_langle_tag,
-	&char_escape,
-	&char_entity,
-	&char_autolink_url,
-	&char_autolink_email,
-	&char_autolink_www,
-	&char_superscript,
-	&char_quote,
-	&char_math
+/* parser_entry: the parsing entry points of one compilation of this file */
+struct parser_entry {
+	void (*block)(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size);
+	void (*span)(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size);
+	void (*footnotes)(rfcdown_buffer *ob, rfcdown_document *doc, struct footnote_list *footnotes);
 };
 
-struct rfcdown_document {
+struct rfcdown_config {
 	rfcdown_renderer md;
+	uint8_t active_char[256];
+	rfcdown_extensions ext_flags;
+	size_t max_nesting;
+	const struct parser_entry *parser;
+};
+
+struct rfcdown_document {
+	const rfcdown_renderer *md;
 	rfcdown_renderer_data data;
 
 	struct link_ref *refs[REF_TABLE_SIZE];
 	struct footnote_list footnotes_found;
 	struct footnote_list footnotes_used;
-	uint8_t active_char[256];
 	rfcdown_stack work_bufs[2];
+	int in_link_body;
+	int shared_refs;	/* refs belong to another document: no href memo */
+	rfcdown_buffer *block_marks;	/* if set, offsets of the top-level blocks */
+	size_t block_limit;	/* no top-level block starts past this offset */
+	int shared_text;	/* the text is read elsewhere too: don't compact it in place */
+	struct span_index *span;	/* of the innermost span being parsed */
+	rfcdown_buffer *code_runs;	/* struct code_run of the spans listed */
+	rfcdown_buffer *table_cols;	/* rfcdown_table_flags of the table being parsed */
+
+	rfcdown_phase_callback phase_callback;
+	void *phase_opaque;
+
+	/* shared configuration, and the fields of it used on hot paths */
+	const rfcdown_config *config;
+	rfcdown_config *own_config;	/* set when made by rfcdown_document_new */
+	const uint8_t *active_char;
 	rfcdown_extensions ext_flags;
 	size_t max_nesting;
-	int in_link_body;
+	const struct parser_entry *parser;
+
+	/* warm state, kept between renders up to `retention` bytes */
+	rfcdown_buffer *text;
+	struct link_ref *spare_refs;
+	struct footnote_item *spare_items;
+	rfcdown_stack spare_footnotes;
+	size_t retention;
 };
 
 /***************************
@@ -184,25 +245,11 @@ hash_link_ref(const uint8_t *link_ref, size_t length)
 	unsigned int hash = 0;
 
 	for (i = 0; i < length; ++i)
-		hash = tolower(link_ref[i]) + (hash << 6) + (hash << 16) - hash;
+		hash = rfcdown_tolower(link_ref[i]) + (hash << 6) + (hash << 16) - hash;
 
 	return hash;
 }
 
-static struct link_ref *
-add_link_ref(
-	struct link_ref **references,
-	const uint8_t *name, size_t name_size)
-{
-	struct link_ref *ref = rfcdown_calloc(1, sizeof(struct link_ref));
-
-	ref->id = hash_link_ref(name, name_size);
-	ref->next = references[ref->id % REF_TABLE_SIZE];
-
-	references[ref->id % REF_TABLE_SIZE] = ref;
-	return ref;
-}
-
 static struct link_ref *
 find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
 {
@@ -221,42 +268,19 @@ find_link_ref(struct link_ref **references, uint8_t *name, size_t length)
 	return NULL;
 }
 
-static void
-free_link_refs(struct link_ref **references)
-{
-	size_t i;
-
-	for (i = 0; i < REF_TABLE_SIZE; ++i) {
-		struct link_ref *r = references[i];
-		struct link_ref *next;
-
-		while (r) {
-			next = r->next;
-			rfcdown_buffer_free(r->link);
-			rfcdown_buffer_free(r->title);
-			free(r);
-			r = next;
-		}
-	}
-}
-
-static struct footnote_ref *
-create_footnote_ref(struct footnote_list *list, const uint8_t *name, size_t name_size)
-{
-	struct footnote_ref *ref = rfcdown_calloc(1, sizeof(struct footnote_ref));
-
-	ref->id = hash_link_ref(name, name_size);
-
-	return ref;
-}
-
 static int
-add_footnote_ref(struct footnote_list *list, struct footnote_ref *ref)
+add_footnote_ref(rfcdown_document *doc, struct footnote_list *list, struct footnote_ref *ref)
 {
-	struct footnote_item *item = rfcdown_calloc(1, sizeof(struct footnote_item));
+	struct footnote_item *item = doc->spare_items;
+
+	if (item)
+		doc->spare_items = item->next;
+	else
+		item = rfcdown_calloc(1, sizeof(struct footnote_item));
 	if (!item)
 		return 0;
 	item->ref = ref;
+	item->next = NULL;
 
 	if (list->head == NULL) {
 		list->head = list->tail = item;
@@ -286,28 +310,6 @@ find_footnote_ref(struct footnote_list *list, uint8_t *name, size_t length)
 	return NULL;
 }
 
-static void
-free_footnote_ref(struct footnote_ref *ref)
-{
-	rfcdown_buffer_free(ref->contents);
-	free(ref);
-}
-
-static void
-free_footnote_list(struct footnote_list *list, int free_refs)
-{
-	struct footnote_item *item = list->head;
-	struct footnote_item *next;
-
-	while (item) {
-		next = item->next;
-		if (free_refs)
-			free_footnote_ref(item->ref);
-		free(item);
-		item = next;
-	}
-}
-
 
 /*
  * Check whether a char is a Markdown spacing char.
@@ -361,6 +363,30 @@ replace_spacing(rfcdown_buffer *ob, const uint8_t *data, size_t size)
  * INLINE PARSING FUNCTIONS *
  ****************************/
 
+/* classes of the bytes of an inline tag or a bracketed autolink */
+#define TAG_SCHEME	1	/* alnums and ".+-", as in a URI scheme */
+#define TAG_MAIL	2	/* alnums and "-._@", as in an e-mail address */
+#define TAG_URI_END	4	/* '>', and what a bracketed URI can't hold: ' " space \n */
+
+static const uint8_t tag_chars[UINT8_MAX+1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	4, 0, 4, 0, 0, 0, 0, 4, 0, 0, 0, 1, 0, 3, 3, 0,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 4, 0,
+	2, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 2,
+	0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
 /* is_mail_autolink • looks for the address part of a mail autolink and '>' */
 /* this is less strict than the original markdown e-mail address matching */
 static size_t
@@ -369,35 +395,19 @@ is_mail_autolink(uint8_t *data, size_t size)
 	size_t i = 0, nb = 0;
 
 	/* address is assumed to be: [-@._a-zA-Z0-9]+ with exactly one '@' */
-	for (i = 0; i < size; ++i) {
-		if (isalnum(data[i]))
-			continue;
-
-		switch (data[i]) {
-			case '@':
-				nb++;
-
-			case '-':
-			case '.':
-			case '_':
-				break;
-
-			case '>':
-				return (nb == 1) ? i + 1 : 0;
-
-			default:
-				return 0;
-		}
-	}
+	for (i = 0; i < size && (tag_chars[data[i]] & TAG_MAIL); ++i)
+		nb += (data[i] == '@');
 
-	return 0;
+	return (i < size && data[i] == '>' && nb == 1) ? i + 1 : 0;
 }
 
-/* tag_length • returns the length of the given tag, or 0 is it's not valid */
+/* tag_length • returns the length of the given tag, or 0 is it's not valid;
+ * gt is where the first '>' after the '<' is, or size if there is none */
 static size_t
-tag_length(uint8_t *data, size_t size, rfcdown_autolink_type *autolink)
+tag_length(uint8_t *data, size_t size, size_t gt, rfcdown_autolink_type *autolink)
 {
 	size_t i, j;
+	const uint8_t *end;
 
 	/* a valid tag can't be shorter than 3 chars */
 	if (size < 3) return 0;
@@ -406,14 +416,18 @@ tag_length(uint8_t *data, size_t size, rfcdown_autolink_type *autolink)
 	if (data[0] != '<') return 0;
 	i = (data[1] == '/') ? 2 : 1;
 
-	if (!isalnum(data[i]))
+	if (!rfcdown_isalnum(data[i]))
+		return 0;
+
+	/* tags and autolinks alike end with a '>' */
+	if (gt >= size)
 		return 0;
 
 	/* scheme test */
 	*autolink = RFCDOWN_AUTOLINK_NONE;
 
 	/* try to find the beginning of an URI */
-	while (i < size && (isalnum(data[i]) || data[i] == '.' || data[i] == '+' || data[i] == '-'))
+	while (i < size && (tag_chars[data[i]] & TAG_SCHEME))
 		i++;
 
 	if (i > 1 && data[i] == '@') {
@@ -428,7 +442,7 @@ tag_length(uint8_t *data, size_t size, rfcdown_autolink_type *autolink)
 		i++;
 	}
 
-	/* completing autolink test: no spacing or ' or " */
+/* completing autolink test: no spacing or ' or " */
 	if (i >= size)
 		*autolink = RFCDOWN_AUTOLINK_NONE;
 
@@ -437,9 +451,7 @@ tag_length(uint8_t *data, size_t size, rfcdown_autolink_type *autolink)
 
 		while (i < size) {
 			if (data[i] == '\\') i += 2;
-			else if (data[i] == '>' || data[i] == '\'' ||
-					data[i] == '"' || data[i] == ' ' || data[i] == '\n')
-					break;
+			else if (tag_chars[data[i]] & TAG_URI_END) break;
 			else i++;
 		}
 
@@ -449,49 +461,195 @@ tag_length(uint8_t *data, size_t size, rfcdown_autolink_type *autolink)
 		*autolink = RFCDOWN_AUTOLINK_NONE;
 	}
 
-	/* looking for something looking like a tag end */
-	while (i < size && data[i] != '>') i++;
-	if (i >= size) return 0;
-	return i + 1;
+	/* looking for something looking like a tag end: gt, unless an
+	 * escape in an autolink stepped over it */
+	if (i <= gt)
+		return gt + 1;
+	if (i >= size || (end = memchr(data + i, '>', size - i)) == NULL)
+		return 0;
+	return end - data + 1;
+}
+
+/* char_trigger • renders the active char at the beginning of data */
+/*   returns the number of chars taken care of */
+/*   data is the pointer of the beginning of the span */
+/*   offset is the number of valid chars before data */
+static size_t
+char_trigger(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
+{
+	switch (doc->active_char[data[0]]) {
+	case MD_CHAR_EMPHASIS:
+		return char_emphasis(ob, doc, data, offset, size);
+	case MD_CHAR_CODESPAN:
+		return char_codespan(ob, doc, data, offset, size);
+	case MD_CHAR_LINEBREAK:
+		return char_linebreak(ob, doc, data, offset, size);
+	case MD_CHAR_LINK:
+		return char_link(ob, doc, data, offset, size);
+	case MD_CHAR_LANGLE:
+		return char_langle_tag(ob, doc, data, offset, size);
+	case MD_CHAR_ESCAPE:
+		return char_escape(ob, doc, data, offset, size);
+	case MD_CHAR_ENTITY:
+		return char_entity(ob, doc, data, offset, size);
+	case MD_CHAR_SUPERSCRIPT:
+		if (DOC_EXT(doc) & RFCDOWN_EXT_SUPERSCRIPT)
+			return char_superscript(ob, doc, data, offset, size);
+		break;
+	case MD_CHAR_QUOTE:
+		if (DOC_EXT(doc) & RFCDOWN_EXT_QUOTE)
+			return char_quote(ob, doc, data, offset, size);
+		break;
+	case MD_CHAR_MATH:
+		if (DOC_EXT(doc) & RFCDOWN_EXT_MATH)
+			return char_math(ob, doc, data, offset, size);
+		break;
+	}
+
+	return 0;
+}
+
+/* char_autolink • renders a link found by the autolink scanner */
+static void
+char_autolink(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size, rfcdown_autolink_kind kind)
+{
+	rfcdown_buffer link = { 0, 0, 0, 0, NULL, NULL, NULL };
+	rfcdown_buffer *link_url, *link_text;
+
+	link.data = data;
+	link.size = size;
+
+	if (kind != RFCDOWN_AUTOLINK_KIND_WWW) {
+		doc->md->autolink(ob, &link, kind == RFCDOWN_AUTOLINK_KIND_EMAIL ?
+			RFCDOWN_AUTOLINK_EMAIL : RFCDOWN_AUTOLINK_NORMAL, &doc->data);
+		return;
+	}
+
+	link_url = newbuf(doc, BUFFER_SPAN);
+	RFCDOWN_BUFPUTSL(link_url, "http://");
+	rfcdown_buffer_put(link_url, data, size);
+
+	if (doc->md->normal_text) {
+		link_text = newbuf(doc, BUFFER_SPAN);
+		doc->md->normal_text(link_text, &link, &doc->data);
+		doc->md->link(ob, link_text, link_url, NULL, &doc->data);
+		popbuf(doc, BUFFER_SPAN);
+	} else {
+		doc->md->link(ob, &link, link_url, NULL, &doc->data);
+	}
+
+	popbuf(doc, BUFFER_SPAN);
+}
+
+/* normal_text • renders text without active chars */
+static void
+normal_text(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size)
+{
+	rfcdown_buffer work = { 0, 0, 0, 0, NULL, NULL, NULL };
+
+	if (doc->md->normal_text) {
+		work.data = data;
+		work.size = size;
+		doc->md->normal_text(ob, &work, &doc->data);
+	}
+	else
+		rfcdown_buffer_put(ob, data, size);
 }
 
 /* parse_inline • parses inline markdown elements */
 static void
 parse_inline(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size)
 {
-	size_t i = 0, end = 0, consumed = 0;
-	rfcdown_buffer work = { 0, 0, 0, 0, NULL, NULL, NULL };
-	uint8_t *active_char = doc->active_char;
+	size_t i = 0, end = 0, consumed = 0, from, taken;
+	size_t link_start = 0, link_size = 0;
+	const uint8_t *active_char = doc->active_char;
+	rfcdown_autolink_scanner links;
+	unsigned int link_kinds = 0;
+	rfcdown_buffer *trigger_ob;
+	int hold;
+	struct span_index span, *outer_span;
 
 	if (doc->work_bufs[BUFFER_SPAN].size +
 		doc->work_bufs[BUFFER_BLOCK].size > doc->max_nesting)
 		return;
 
+	/* backticks, dollars and '>' are only looked for once they are needed */
+	span.data = data;
+	span.size = size;
+	span.code_listed = 0;
+	span.math_ready = 0;
+	span.angle_from = (size_t)-1;
+	span.angle_at = 0;
+	outer_span = doc->span;
+	doc->span = &span;
+
+	/* no autolinking inside the content of a link */
+	if ((DOC_EXT(doc) & RFCDOWN_EXT_AUTOLINK) && !doc->in_link_body) {
+		if (doc->md->autolink)
+			link_kinds |= RFCDOWN_AUTOLINK_KIND_URL | RFCDOWN_AUTOLINK_KIND_EMAIL;
+		if (doc->md->link)
+			link_kinds |= RFCDOWN_AUTOLINK_KIND_WWW;
+	}
+	rfcdown_autolink_scanner_init(&links, link_kinds, 0);
+
 	while (i < size) {
 		/* copying inactive chars into the output */
+		from = end;
 		while (end < size && active_char[data[end]] == 0)
 			end++;
 
-		if (doc->md.normal_text) {
-			work.data = data + i;
-			work.size = end - i;
-			doc->md.normal_text(ob, &work, &doc->data);
+		/* up to a link if the scanner finds one first, in them or
+		 * the active char after them */
+		if (link_kinds)
+			link_start = rfcdown_autolink_next(&links, &link_size,
+				data, from, end < size ? end + 1 : size, size);
+
+		/* an active char in the middle of an address, like the '_' of
+		 * "john_doe@example.com", leaves the text before it pending
+		 * until the trigger turns it down or takes it */
+		hold = link_kinds && !link_size && end < size && links.local < end;
+
+		if (link_size) {
+			normal_text(ob, doc, data + i, link_start - i);
+			char_autolink(ob, doc, data + link_start, link_size, links.found);
+			i = link_start + link_size;
+			end = i;
+			consumed = i;
+			rfcdown_autolink_restart(&links, i);
+			continue;
 		}
-		else
-			rfcdown_buffer_put(ob, data + i, end - i);
+
+		if (!hold)
+			normal_text(ob, doc, data + i, end - i);
 
 		if (end >= size) break;
-		i = end;
 
-		end = markdown_char_ptrs[ (int)active_char[data[end]] ](ob, doc, data + i, i - consumed, size - i);
-		if (!end) /* no action from the callback */
-			end = i + 1;
+		if (hold) {
+			trigger_ob = newbuf(doc, BUFFER_SPAN);
+			taken = char_trigger(trigger_ob, doc, data + end, end - consumed, size - end);
+			if (taken) {
+				normal_text(ob, doc, data + i, end - i);
+				rfcdown_buffer_put(ob, trigger_ob->data, trigger_ob->size);
+			}
+			popbuf(doc, BUFFER_SPAN);
+		} else {
+			i = end;
+			taken = char_trigger(ob, doc, data + end, end - consumed, size - end);
+		}
+
+		if (!taken) /* no action from the callback */
+			end++;
 		else {
-			i += end;
+			i = end + taken;
 			end = i;
 			consumed = i;
+			rfcdown_autolink_restart(&links, i);
 		}
 	}
+
+	doc->span = outer_span;
+	if (span.code_listed)
+		doc->code_runs->size = span.code_first * sizeof(struct code_run);
 }
 
 /* is_escaped • returns whether special char at data[loc] is escaped by '\\' */
@@ -619,18 +777,18 @@ parse_emph1(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 
 		if (data[i] == c && !_isspace(data[i - 1])) {
 
-			if (doc->ext_flags & RFCDOWN_EXT_NO_INTRA_EMPHASIS) {
-				if (i + 1 < size && isalnum(data[i + 1]))
+			if (DOC_EXT(doc) & RFCDOWN_EXT_NO_INTRA_EMPHASIS) {
+				if (i + 1 < size && rfcdown_isalnum(data[i + 1]))
 					continue;
 			}
 
 			work = newbuf(doc, BUFFER_SPAN);
 			parse_inline(work, doc, data, i);
 
-			if (doc->ext_flags & RFCDOWN_EXT_UNDERLINE && c == '_')
-				r = doc->md.underline(ob, work, &doc->data);
+			if (DOC_EXT(doc) & RFCDOWN_EXT_UNDERLINE && c == '_')
+				r = doc->md->underline(ob, work, &doc->data);
 			else
-				r = doc->md.emphasis(ob, work, &doc->data);
+				r = doc->md->emphasis(ob, work, &doc->data);
 
 			popbuf(doc, BUFFER_SPAN);
 			return r ? i + 1 : 0;
@@ -658,11 +816,11 @@ parse_emph2(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 			parse_inline(work, doc, data, i);
 
 			if (c == '~')
-				r = doc->md.strikethrough(ob, work, &doc->data);
+				r = doc->md->strikethrough(ob, work, &doc->data);
 			else if (c == '=')
-				r = doc->md.highlight(ob, work, &doc->data);
+				r = doc->md->highlight(ob, work, &doc->data);
 			else
-				r = doc->md.double_emphasis(ob, work, &doc->data);
+				r = doc->md->double_emphasis(ob, work, &doc->data);
 
 			popbuf(doc, BUFFER_SPAN);
 			return r ? i + 2 : 0;
@@ -689,12 +847,12 @@ parse_emph3(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 		if (data[i] != c || _isspace(data[i - 1]))
 			continue;
 
-		if (i + 2 < size && data[i + 1] == c && data[i + 2] == c && doc->md.triple_emphasis) {
+		if (i + 2 < size && data[i + 1] == c && data[i + 2] == c && doc->md->triple_emphasis) {
 			/* triple symbol found */
 			rfcdown_buffer *work = newbuf(doc, BUFFER_SPAN);
 
 			parse_inline(work, doc, data, i);
-			r = doc->md.triple_emphasis(ob, work, &doc->data);
+			r = doc->md->triple_emphasis(ob, work, &doc->data);
 			popbuf(doc, BUFFER_SPAN);
 			return r ? i + 3 : 0;
 
@@ -714,29 +872,140 @@ parse_emph3(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 	return 0;
 }
 
+/* span_at • the innermost span being parsed, if data is the rest of it */
+static struct span_index *
+span_at(rfcdown_document *doc, const uint8_t *data, size_t size)
+{
+	struct span_index *span = doc->span;
+
+	if (!span || data < span->data || data + size != span->data + span->size)
+		return NULL;
+
+	return span;
+}
+
+/* next_dollar • returns where the first unescaped '$' at or after `from`
+ * is, one followed by another '$' if twice, or the size of the span if
+ * there is none. The answer is kept with where it was looked for from, and
+ * given again to any call from in between: the parser only moves forward,
+ * so the span is read once for each kind of delimiter. */
+static size_t
+next_dollar(struct span_index *span, size_t from, size_t *memo_from, size_t *memo_at, int twice)
+{
+	uint8_t *data = (uint8_t *)span->data;
+	const uint8_t *sign = NULL;
+	size_t i = from;
+
+	if (*memo_from <= from && from <= *memo_at)
+		return *memo_at;
+
+	while (i < span->size && (sign = memchr(data + i, '$', span->size - i)) != NULL) {
+		i = sign - data;
+		if (!is_escaped(data, i) &&
+			(!twice || (i + 1 < span->size && data[i + 1] == '$')))
+			break;
+		i++;
+	}
+
+	if (!sign)
+		i = span->size;
+
+	*memo_from = from;
+	*memo_at = i;
+	return i;
+}
+
+/* find_memo • where the first c at or after `from` is in data, or size if
+ * there is none. The answer is kept with where it was looked for from, as
+ * next_dollar's is, and given again to any call from in between. */
+static size_t
+find_memo(const uint8_t *data, size_t size, uint8_t c, size_t from, size_t *memo_from, size_t *memo_at)
+{
+	const uint8_t *p = NULL;
+
+	if (*memo_from <= from && from <= *memo_at)
+		return *memo_at;
+
+	if (from < size)
+		p = memchr(data + from, c, size - from);
+
+	*memo_from = from;
+	*memo_at = p ? (size_t)(p - data) : size;
+	return *memo_at;
+}
+
+/* find_dollar_closer • returns where the "$" or "$$" opened at data[pos]
+ * of the span is closed, from pos, or 0 if it never is */
+static size_t
+find_dollar_closer(struct span_index *span, size_t pos, size_t delimsz)
+{
+	size_t at;
+
+	if (!span->math_ready) {
+		span->math_ready = 1;
+		span->dollar_from = span->double_from = (size_t)-1;
+		span->dollar_at = span->double_at = 0;
+		span->blank_from = (size_t)-1;
+		span->blank_end = 0;
+		for (at = span->size; at > 0 && _isspace(span->data[at - 1]); at--);
+		span->text_end = at;
+	}
+
+	if (delimsz == 2)
+		at = next_dollar(span, pos + 2, &span->double_from, &span->double_at, 1);
+	else
+		at = next_dollar(span, pos + 1, &span->dollar_from, &span->dollar_at, 0);
+
+	return at < span->size ? at - pos : 0;
+}
+
+/* is_blank_between • whether the span has only spaces in [from, to); the
+ * end of the spaces after `from` is kept for the next call from there */
+static int
+is_blank_between(struct span_index *span, size_t from, size_t to)
+{
+	size_t i;
+
+	if (span->blank_from != from) {
+		for (i = from; i < span->size && _isspace(span->data[i]); i++);
+		span->blank_from = from;
+		span->blank_end = i;
+	}
+
+	return span->blank_end >= to;
+}
+
 /* parse_math • parses a math span until the given ending delimiter */
 static size_t
 parse_math(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size, const char *end, size_t delimsz, int displaymode)
 {
 	rfcdown_buffer text = { NULL, 0, 0, 0, NULL, NULL, NULL };
-	size_t i = delimsz;
+	struct span_index *span = NULL;
+	size_t i = delimsz, pos = 0;
 
-	if (!doc->md.math)
+	if (!doc->md->math)
 		return 0;
 
-	/* find ending delimiter */
-	while (1) {
-		while (i < size && data[i] != (uint8_t)end[0])
-			i++;
-
-		if (i >= size)
+	/* find ending delimiter, from the last one found if it is a dollar */
+	if (end[0] == '$' && (span = span_at(doc, data, size)) != NULL) {
+		pos = data - span->data;
+		i = find_dollar_closer(span, pos, delimsz);
+		if (!i)
 			return 0;
+	} else {
+		while (1) {
+			while (i < size && data[i] != (uint8_t)end[0])
+				i++;
 
-		if (!is_escaped(data, i) && !(i + delimsz > size)
-			&& memcmp(data + i, end, delimsz) == 0)
-			break;
+			if (i >= size)
+				return 0;
 
-		i++;
+			if (!is_escaped(data, i) && !(i + delimsz > size)
+				&& memcmp(data + i, end, delimsz) == 0)
+				break;
+
+			i++;
+		}
 	}
 
 	/* prepare buffers */
@@ -746,11 +1015,16 @@ parse_math(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offs
 	/* if this is a $$ and MATH_EXPLICIT is not active,
 	 * guess whether displaymode should be enabled from the context */
 	i += delimsz;
-	if (delimsz == 2 && !(doc->ext_flags & RFCDOWN_EXT_MATH_EXPLICIT))
-		displaymode = is_empty_all(data - offset, offset) && is_empty_all(data + i, size - i);
+	if (delimsz == 2 && !(DOC_EXT(doc) & RFCDOWN_EXT_MATH_EXPLICIT)) {
+		if (span)
+			displaymode = pos + i >= span->text_end &&
+				is_blank_between(span, pos - offset, pos);
+		else
+			displaymode = is_empty_all(data - offset, offset) && is_empty_all(data + i, size - i);
+	}
 
 	/* call callback */
-	if (doc->md.math(ob, &text, displaymode, &doc->data))
+	if (doc->md->math(ob, &text, displaymode, &doc->data))
 		return i;
 
 	return 0;
@@ -763,7 +1037,7 @@ char_emphasis(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t o
 	uint8_t c = data[0];
 	size_t ret;
 
-	if (doc->ext_flags & RFCDOWN_EXT_NO_INTRA_EMPHASIS) {
+	if (DOC_EXT(doc) & RFCDOWN_EXT_NO_INTRA_EMPHASIS) {
 		if (offset > 0 && !_isspace(data[-1]) && data[-1] != '>' && data[-1] != '(')
 			return 0;
 	}
@@ -806,29 +1080,99 @@ char_linebreak(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 	while (ob->size && ob->data[ob->size - 1] == ' ')
 		ob->size--;
 
-	return doc->md.linebreak(ob, &doc->data) ? 1 : 0;
+	return doc->md->linebreak(ob, &doc->data) ? 1 : 0;
 }
 
 
-/* char_codespan • '`' parsing a code span (assuming codespan != 0) */
+/* list_code_runs • lists the backtick runs of a span in doc->code_runs */
+static void
+list_code_runs(rfcdown_document *doc, struct span_index *span)
+{
+	const uint8_t *data = span->data, *tick;
+	struct code_run run, *runs;
+	size_t i = 0, k, longest = 0;
+
+	if (!doc->code_runs)
+		doc->code_runs = rfcdown_buffer_new(16 * sizeof(struct code_run));
+
+	span->code_listed = 1;
+	span->code_first = doc->code_runs->size / sizeof(struct code_run);
+	span->code_count = 0;
+	span->code_next = 0;
+
+	while (i < span->size &&
+		(tick = memchr(data + i, '`', span->size - i)) != NULL) {
+		run.start = tick - data;
+		for (i = run.start + 1; i < span->size && data[i] == '`'; i++);
+		run.size = i - run.start;
+		run.longest = 0;
+		if (doc->code_runs->size + sizeof(run) > doc->code_runs->asize)
+			rfcdown_buffer_grow(doc->code_runs, 2 * doc->code_runs->asize);
+		rfcdown_buffer_put(doc->code_runs, (const uint8_t *)&run, sizeof(run));
+		span->code_count++;
+	}
+
+	runs = (struct code_run *)doc->code_runs->data + span->code_first;
+	for (k = span->code_count; k > 0; k--) {
+		if (runs[k - 1].size > longest)
+			longest = runs[k - 1].size;
+		runs[k - 1].longest = longest;
+	}
+}
+
+/* find_code_closer • returns where the code span opened by the *nb
+ * backticks at data ends, right after the first *nb backticks in a row
+ * past the opening run, or 0 if there are none. In the innermost span,
+ * the runs are listed on the first call, so that each of the others
+ * costs no more than the runs it steps over, and one with no closer
+ * costs nothing at all: a line of unmatched backticks stays linear. */
 static size_t
-char_codespan(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
+find_code_closer(rfcdown_document *doc, uint8_t *data, size_t size, size_t *nb)
 {
-	rfcdown_buffer work = { NULL, 0, 0, 0, NULL, NULL, NULL };
-	size_t end, nb = 0, i, f_begin, f_end;
+	struct span_index *span = span_at(doc, data, size);
+	struct code_run *runs;
+	size_t end, i, pos, k;
 
-	/* counting the number of backticks in the delimiter */
-	while (nb < size && data[nb] == '`')
-		nb++;
+	if (!span) {
+		for (*nb = 0; *nb < size && data[*nb] == '`'; (*nb)++);
 
-	/* finding the next delimiter */
-	i = 0;
-	for (end = nb; end < size && i < nb; end++) {
-		if (data[end] == '`') i++;
-		else i = 0;
+		i = 0;
+		for (end = *nb; end < size && i < *nb; end++) {
+			if (data[end] == '`') i++;
+			else i = 0;
+		}
+		return i < *nb ? 0 : end;
 	}
 
-	if (i < nb && end >= size)
+	if (!span->code_listed)
+		list_code_runs(doc, span);
+
+	runs = (struct code_run *)doc->code_runs->data + span->code_first;
+	pos = data - span->data;
+
+	/* the opener ends the run it is in */
+	for (k = span->code_next; k < span->code_count && runs[k].start + runs[k].size <= pos; k++);
+	span->code_next = k;
+	*nb = runs[k].start + runs[k].size - pos;
+
+	for (k++; k < span->code_count && runs[k].longest >= *nb; k++)
+		if (runs[k].size >= *nb)
+			return runs[k].start + *nb - pos;
+
+	return 0;
+}
+
+/* char_codespan • '`' parsing a code span (assuming codespan != 0) */
+static size_t
+char_codespan(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
+{
+	rfcdown_buffer work = { NULL, 0, 0, 0, NULL, NULL, NULL };
+	size_t end, nb, f_begin, f_end;
+
+	/* counting the number of backticks in the delimiter, and finding
+	 * the next one */
+	end = find_code_closer(doc, data, size, &nb);
+	if (!end)
 		return 0; /* no matching delimiter */
 
 	/* trimming outside spaces */
@@ -845,10 +1189,10 @@ char_codespan(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t o
 		work.data = data + f_begin;
 		work.size = f_end - f_begin;
 
-		if (!doc->md.codespan(ob, &work, &doc->data))
+		if (!doc->md->codespan(ob, &work, &doc->data))
 			end = 0;
 	} else {
-		if (!doc->md.codespan(ob, 0, &doc->data))
+		if (!doc->md->codespan(ob, 0, &doc->data))
 			end = 0;
 	}
 
@@ -890,11 +1234,11 @@ char_quote(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offs
 		rfcdown_buffer *work = newbuf(doc, BUFFER_SPAN);
 		parse_inline(work, doc, data + f_begin, f_end - f_begin);
 
-		if (!doc->md.quote(ob, work, &doc->data))
+		if (!doc->md->quote(ob, work, &doc->data))
 			end = 0;
 		popbuf(doc, BUFFER_SPAN);
 	} else {
-		if (!doc->md.quote(ob, 0, &doc->data))
+		if (!doc->md->quote(ob, 0, &doc->data))
 			end = 0;
 	}
 
@@ -907,11 +1251,10 @@ static size_t
 char_escape(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
 {
 	static const char *escape_chars = "\\`*_{}[]()#+-.!:|&<>^~=\"$";
-	rfcdown_buffer work = { 0, 0, 0, 0, NULL, NULL, NULL };
 	size_t w;
 
 	if (size > 1) {
-		if (data[1] == '\\' && (doc->ext_flags & RFCDOWN_EXT_MATH) &&
+		if (data[1] == '\\' && (DOC_EXT(doc) & RFCDOWN_EXT_MATH) &&
 			size > 2 && (data[2] == '(' || data[2] == '[')) {
 			const char *end = (data[2] == '[') ? "\\\\]" : "\\\\)";
 			w = parse_math(ob, doc, data, offset, size, end, 3, data[2] == '[');
@@ -921,14 +1264,9 @@ char_escape(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t off
 		if (strchr(escape_chars, data[1]) == NULL)
 			return 0;
 
-		if (doc->md.normal_text) {
-			work.data = data + 1;
-			work.size = 1;
-			doc->md.normal_text(ob, &work, &doc->data);
-		}
-		else rfcdown_buffer_putc(ob, data[1]);
+		normal_text(ob, doc, data + 1, 1);
 	} else if (size == 1) {
-		rfcdown_buffer_putc(ob, data[0]);
+		normal_text(ob, doc, data, 1);
 	}
 
 	return 2;
@@ -945,7 +1283,7 @@ char_entity(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t off
 	if (end < size && data[end] == '#')
 		end++;
 
-	while (end < size && isalnum(data[end]))
+	while (end < size && rfcdown_isalnum(data[end]))
 		end++;
 
 	if (end < size && data[end] == ';')
@@ -953,10 +1291,10 @@ char_entity(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t off
 	else
 		return 0; /* lone '&' */
 
-	if (doc->md.entity) {
+	if (doc->md->entity) {
 		work.data = data;
 		work.size = end;
-		doc->md.entity(ob, &work, &doc->data);
+		doc->md->entity(ob, &work, &doc->data);
 	}
 	else rfcdown_buffer_put(ob, data, end);
 
@@ -969,138 +1307,67 @@ char_langle_tag(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 {
 	rfcdown_buffer work = { NULL, 0, 0, 0, NULL, NULL, NULL };
 	rfcdown_autolink_type altype = RFCDOWN_AUTOLINK_NONE;
-	size_t end = tag_length(data, size, &altype);
+	struct span_index *span = span_at(doc, data, size);
+	const uint8_t *angle;
+	size_t gt, end;
 	int ret = 0;
 
+	/* a '<' with no '>' after it in the span takes no rescan */
+	if (span)
+		gt = find_memo(span->data, span->size, '>', data - span->data + 1,
+			&span->angle_from, &span->angle_at) - (data - span->data);
+	else
+		gt = (size > 1 && (angle = memchr(data + 1, '>', size - 1)) != NULL) ?
+			(size_t)(angle - data) : size;
+
+	end = tag_length(data, size, gt, &altype);
+
 	work.data = data;
 	work.size = end;
 
 	if (end > 2) {
-		if (doc->md.autolink && altype != RFCDOWN_AUTOLINK_NONE) {
+		if (doc->md->autolink && altype != RFCDOWN_AUTOLINK_NONE) {
 			rfcdown_buffer *u_link = newbuf(doc, BUFFER_SPAN);
 			work.data = data + 1;
 			work.size = end - 2;
 			unscape_text(u_link, &work);
-			ret = doc->md.autolink(ob, u_link, altype, &doc->data);
+			ret = doc->md->autolink(ob, u_link, altype, &doc->data);
 			popbuf(doc, BUFFER_SPAN);
 		}
-		else if (doc->md.raw_html)
-			ret = doc->md.raw_html(ob, &work, &doc->data);
+		else if (doc->md->raw_html)
+			ret = doc->md->raw_html(ob, &work, &doc->data);
 	}
 
 	if (!ret) return 0;
 	else return end;
 }
 
+/* char_link • '[': parsing a link, a footnote or an image */
 static size_t
-char_autolink_www(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
+char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
 {
-	rfcdown_buffer *link, *link_url, *link_text;
-	size_t link_len, rewind;
-
-	if (!doc->md.link || doc->in_link_body)
-		return 0;
+	int is_img = (offset && data[-1] == '!' && !is_escaped(data - offset, offset - 1));
+	int is_footnote = (DOC_EXT(doc) & RFCDOWN_EXT_FOOTNOTES && data[1] == '^');
+	size_t i = 1, txt_e, link_b = 0, link_e = 0, title_b = 0, title_e = 0;
+	rfcdown_buffer *content = NULL;
+	rfcdown_buffer *link = NULL;
+	rfcdown_buffer *title = NULL;
+	rfcdown_buffer *u_link = NULL;
+	struct link_ref *ref = NULL;
+	size_t org_work_size = doc->work_bufs[BUFFER_SPAN].size;
+	int ret = 0, in_title = 0, qtype = 0;
 
-	link = newbuf(doc, BUFFER_SPAN);
+	/* checking whether the correct renderer exists */
+	if ((is_footnote && !doc->md->footnote_ref) || (is_img && !doc->md->image)
+		|| (!is_img && !is_footnote && !doc->md->link))
+		goto cleanup;
 
-	if ((link_len = rfcdown_autolink__www(&rewind, link, data, offset, size, RFCDOWN_AUTOLINK_SHORT_DOMAINS)) > 0) {
-		link_url = newbuf(doc, BUFFER_SPAN);
-		RFCDOWN_BUFPUTSL(link_url, "http://");
-		rfcdown_buffer_put(link_url, link->data, link->size);
+	/* looking for the matching closing bracket */
+	i += find_emph_char(data + i, size - i, ']');
+	txt_e = i;
 
-		if (ob->size > rewind)
-			ob->size -= rewind;
-		else
-			ob->size = 0;
-
-		if (doc->md.normal_text) {
-			link_text = newbuf(doc, BUFFER_SPAN);
-			doc->md.normal_text(link_text, link, &doc->data);
-			doc->md.link(ob, link_text, link_url, NULL, &doc->data);
-			popbuf(doc, BUFFER_SPAN);
-		} else {
-			doc->md.link(ob, link, link_url, NULL, &doc->data);
-		}
-		popbuf(doc, BUFFER_SPAN);
-	}
-
-	popbuf(doc, BUFFER_SPAN);
-	return link_len;
-}
-
-static size_t
-char_autolink_email(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
-{
-	rfcdown_buffer *link;
-	size_t link_len, rewind;
-
-	if (!doc->md.autolink || doc->in_link_body)
-		return 0;
-
-	link = newbuf(doc, BUFFER_SPAN);
-
-	if ((link_len = rfcdown_autolink__email(&rewind, link, data, offset, size, 0)) > 0) {
-		if (ob->size > rewind)
-			ob->size -= rewind;
-		else
-			ob->size = 0;
-
-		doc->md.autolink(ob, link, RFCDOWN_AUTOLINK_EMAIL, &doc->data);
-	}
-
-	popbuf(doc, BUFFER_SPAN);
-	return link_len;
-}
-
-static size_t
-char_autolink_url(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
-{
-	rfcdown_buffer *link;
-	size_t link_len, rewind;
-
-	if (!doc->md.autolink || doc->in_link_body)
-		return 0;
-
-	link = newbuf(doc, BUFFER_SPAN);
-
-	if ((link_len = rfcdown_autolink__url(&rewind, link, data, offset, size, 0)) > 0) {
-		if (ob->size > rewind)
-			ob->size -= rewind;
-		else
-			ob->size = 0;
-
-		doc->md.autolink(ob, link, RFCDOWN_AUTOLINK_NORMAL, &doc->data);
-	}
-
-	popbuf(doc, BUFFER_SPAN);
-	return link_len;
-}
-
-/* char_link • '[': parsing a link, a footnote or an image */
-static size_t
-char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offset, size_t size)
-{
-	int is_img = (offset && data[-1] == '!' && !is_escaped(data - offset, offset - 1));
-	int is_footnote = (doc->ext_flags & RFCDOWN_EXT_FOOTNOTES && data[1] == '^');
-	size_t i = 1, txt_e, link_b = 0, link_e = 0, title_b = 0, title_e = 0;
-	rfcdown_buffer *content = NULL;
-	rfcdown_buffer *link = NULL;
-	rfcdown_buffer *title = NULL;
-	rfcdown_buffer *u_link = NULL;
-	size_t org_work_size = doc->work_bufs[BUFFER_SPAN].size;
-	int ret = 0, in_title = 0, qtype = 0;
-
-	/* checking whether the correct renderer exists */
-	if ((is_footnote && !doc->md.footnote_ref) || (is_img && !doc->md.image)
-		|| (!is_img && !is_footnote && !doc->md.link))
-		goto cleanup;
-
-	/* looking for the matching closing bracket */
-	i += find_emph_char(data + i, size - i, ']');
-	txt_e = i;
-
-	if (i < size && data[i] == ']') i++;
-	else goto cleanup;
+	if (i < size && data[i] == ']') i++;
+	else goto cleanup;
 
 	/* footnote link */
 	if (is_footnote) {
@@ -1117,14 +1384,14 @@ char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
 
 		/* mark footnote used */
 		if (fr && !fr->is_used) {
-			if(!add_footnote_ref(&doc->footnotes_used, fr))
+			if(!add_footnote_ref(doc, &doc->footnotes_used, fr))
 				goto cleanup;
 			fr->is_used = 1;
 			fr->num = doc->footnotes_used.count;
 
 			/* render */
-			if (doc->md.footnote_ref)
-				ret = doc->md.footnote_ref(ob, fr->num, &doc->data);
+			if (doc->md->footnote_ref)
+				ret = doc->md->footnote_ref(ob, fr->num, &doc->data);
 		}
 
 		goto cleanup;
@@ -1241,8 +1508,9 @@ char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
 			goto cleanup;
 
 		/* keeping link and title from link_ref */
-		link = lr->link;
+		u_link = lr->link;
 		title = lr->title;
+		ref = lr;
 		i++;
 	}
 
@@ -1260,8 +1528,9 @@ char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
 			goto cleanup;
 
 		/* keeping link and title from link_ref */
-		link = lr->link;
+		u_link = lr->link;
 		title = lr->title;
+		ref = lr;
 
 		/* rewinding the spacing */
 		i = txt_e + 1;
@@ -1286,16 +1555,25 @@ char_link(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
 		unscape_text(u_link, link);
 	}
 
+	/* references are already unescaped, and keep a memo for the renderer */
+	if (ref && u_link && !doc->shared_refs) {
+		if (!ref->href_memo)
+			ref->href_memo = rfcdown_buffer_new(64);
+		doc->data.href_memo = ref->href_memo;
+	}
+
 	/* calling the relevant rendering function */
 	if (is_img) {
 		if (ob->size && ob->data[ob->size - 1] == '!')
 			ob->size -= 1;
 
-		ret = doc->md.image(ob, u_link, title, content, &doc->data);
+		ret = doc->md->image(ob, u_link, title, content, &doc->data);
 	} else {
-		ret = doc->md.link(ob, content, u_link, title, &doc->data);
+		ret = doc->md->link(ob, content, u_link, title, &doc->data);
 	}
 
+	doc->data.href_memo = NULL;
+
 	/* cleanup */
 cleanup:
 	doc->work_bufs[BUFFER_SPAN].size = (int)org_work_size;
@@ -1308,7 +1586,7 @@ char_superscript(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 	size_t sup_start, sup_len;
 	rfcdown_buffer *sup;
 
-	if (!doc->md.superscript)
+	if (!doc->md->superscript)
 		return 0;
 
 	if (size < 2)
@@ -1332,7 +1610,7 @@ char_superscript(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 
 	sup = newbuf(doc, BUFFER_SPAN);
 	parse_inline(sup, doc, data + sup_start, sup_len - sup_start);
-	doc->md.superscript(ob, sup, &doc->data);
+	doc->md->superscript(ob, sup, &doc->data);
 	popbuf(doc, BUFFER_SPAN);
 
 	return (sup_start == 2) ? sup_len + 1 : sup_len;
@@ -1346,7 +1624,7 @@ char_math(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
 		return parse_math(ob, doc, data, offset, size, "$$", 2, 1);
 
 	/* single dollar allowed only with MATH_EXPLICIT flag */
-	if (doc->ext_flags & RFCDOWN_EXT_MATH_EXPLICIT)
+	if (DOC_EXT(doc) & RFCDOWN_EXT_MATH_EXPLICIT)
 		return parse_math(ob, doc, data, offset, size, "$", 1, 0);
 
 	return 0;
@@ -1356,6 +1634,61 @@ char_math(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t offse
  * BLOCK-LEVEL PARSING FUNCTIONS *
  *********************************/
 
+/* the blocks a line can start, told apart by its first non-space byte */
+#define BLOCK_ATX	1	/* '#' at the margin */
+#define BLOCK_HTML	2	/* '<' at the margin */
+#define BLOCK_SETEXT	4	/* '=' or '-' at the margin, under a paragraph */
+#define BLOCK_HRULE	8	/* '*' '-' '_' */
+#define BLOCK_FENCE	16	/* '~' '`' */
+#define BLOCK_QUOTE	32	/* '>' */
+#define BLOCK_ULI	64	/* '*' '+' '-' */
+#define BLOCK_OLI	128	/* digits */
+#define BLOCK_EMPTY	256	/* nothing but spaces */
+#define BLOCK_CODE	512	/* four spaces */
+
+#define BLOCK_MARGIN (BLOCK_ATX | BLOCK_HTML | BLOCK_SETEXT)
+
+static const uint8_t block_chars[UINT8_MAX+1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 72, 64, 0, 76, 0, 0,
+	128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 0, 0, 2, 4, 32, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 8,
+	16, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+/* block_start • returns the blocks the line may start, which the
+ * predicates below then confirm; tables are told by their '|' instead */
+static unsigned int
+block_start(const uint8_t *data, size_t size)
+{
+	size_t i = 0;
+
+	while (i < 3 && i < size && data[i] == ' ')
+		i++;
+
+	if (i >= size || data[i] == '\n')
+		return BLOCK_EMPTY;
+
+	if (data[i] == ' ')
+		return BLOCK_EMPTY | BLOCK_CODE;
+
+	if (i > 0)
+		return block_chars[data[i]] & ~BLOCK_MARGIN;
+
+	return block_chars[data[i]];
+}
+
 /* is_empty • returns the line length when it is empty, 0 otherwise */
 static size_t
 is_empty(const uint8_t *data, size_t size)
@@ -1470,7 +1803,7 @@ is_atxheader(rfcdown_document *doc, uint8_t *data, size_t size)
 	if (data[0] != '#')
 		return 0;
 
-	if (doc->ext_flags & RFCDOWN_EXT_SPACE_HEADERS) {
+	if (DOC_EXT(doc) & RFCDOWN_EXT_SPACE_HEADERS) {
 		size_t level = 0;
 
 		while (level < size && level < 6 && data[level] == '#')
@@ -1605,9 +1938,11 @@ parse_blockquote(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 {
 	size_t beg, end = 0, pre, work_size = 0;
 	uint8_t *work_data = 0;
-	rfcdown_buffer *out = 0;
+	rfcdown_buffer *out = 0, *work = 0;
 
 	out = newbuf(doc, BUFFER_BLOCK);
+	if (doc->shared_text)
+		work = newbuf(doc, BUFFER_BLOCK);
 	beg = 0;
 	while (beg < size) {
 		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++);
@@ -1623,8 +1958,9 @@ parse_blockquote(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 				!is_empty(data + end, size - end))))
 			break;
 
-		if (beg < end) { /* copy into the in-place working buffer */
-			/* rfcdown_buffer_put(work, data + beg, end - beg); */
+		if (beg < end && work)
+			rfcdown_buffer_put(work, data + beg, end - beg);
+		else if (beg < end) { /* copy into the in-place working buffer */
 			if (!work_data)
 				work_data = data + beg;
 			else if (data + beg != work_data + work_size)
@@ -1634,9 +1970,15 @@ parse_blockquote(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 		beg = end;
 	}
 
-	parse_block(out, doc, work_data, work_size);
-	if (doc->md.blockquote)
-		doc->md.blockquote(ob, out, &doc->data);
+	if (work) {
+		parse_block(out, doc, work->data, work->size);
+		popbuf(doc, BUFFER_BLOCK);
+	} else {
+		parse_block(out, doc, work_data, work_size);
+	}
+
+	if (doc->md->blockquote)
+		doc->md->blockquote(ob, out, &doc->data);
 	popbuf(doc, BUFFER_BLOCK);
 	return end;
 }
@@ -1650,22 +1992,27 @@ parse_paragraph(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 {
 	rfcdown_buffer work = { NULL, 0, 0, 0, NULL, NULL, NULL };
 	size_t i = 0, end = 0;
+	const uint8_t *nl;
+	unsigned int start;
 	int level = 0;
 
 	work.data = data;
 
 	while (i < size) {
-		for (end = i + 1; end < size && data[end - 1] != '\n'; end++) /* empty */;
+		nl = memchr(data + i, '\n', size - i);
+		end = nl ? (size_t)(nl - data) + 1 : size;
+		start = block_start(data + i, size - i);
 
-		if (is_empty(data + i, size - i))
+		if (start & BLOCK_EMPTY && is_empty(data + i, size - i))
 			break;
 
-		if ((level = is_headerline(data + i, size - i)) != 0)
+		if (start & BLOCK_SETEXT &&
+			(level = is_headerline(data + i, size - i)) != 0)
 			break;
 
-		if (is_atxheader(doc, data + i, size - i) ||
-			is_hrule(data + i, size - i) ||
-			prefix_quote(data + i, size - i)) {
+		if ((start & BLOCK_ATX && is_atxheader(doc, data + i, size - i)) ||
+			(start & BLOCK_HRULE && is_hrule(data + i, size - i)) ||
+			(start & BLOCK_QUOTE && prefix_quote(data + i, size - i))) {
 			end = i;
 			break;
 		}
@@ -1680,8 +2027,8 @@ parse_paragraph(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 	if (!level) {
 		rfcdown_buffer *tmp = newbuf(doc, BUFFER_BLOCK);
 		parse_inline(tmp, doc, work.data, work.size);
-		if (doc->md.paragraph)
-			doc->md.paragraph(ob, tmp, &doc->data);
+		if (doc->md->paragraph)
+			doc->md->paragraph(ob, tmp, &doc->data);
 		popbuf(doc, BUFFER_BLOCK);
 	} else {
 		rfcdown_buffer *header_work;
@@ -1702,8 +2049,8 @@ parse_paragraph(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 				rfcdown_buffer *tmp = newbuf(doc, BUFFER_BLOCK);
 				parse_inline(tmp, doc, work.data, work.size);
 
-				if (doc->md.paragraph)
-					doc->md.paragraph(ob, tmp, &doc->data);
+				if (doc->md->paragraph)
+					doc->md->paragraph(ob, tmp, &doc->data);
 
 				popbuf(doc, BUFFER_BLOCK);
 				work.data += beg;
@@ -1715,8 +2062,8 @@ parse_paragraph(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 		header_work = newbuf(doc, BUFFER_SPAN);
 		parse_inline(header_work, doc, work.data, work.size);
 
-		if (doc->md.header)
-			doc->md.header(ob, header_work, (int)level, &doc->data);
+		if (doc->md->header)
+			doc->md->header(ob, header_work, (int)level, &doc->data);
 
 		popbuf(doc, BUFFER_SPAN);
 	}
@@ -1734,21 +2081,22 @@ parse_fencedcode(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 	size_t w, w2;
 	size_t width, width2;
 	uint8_t chr, chr2;
+	const uint8_t *nl;
 
 	/* parse codefence line */
-	while (i < size && data[i] != '\n')
-		i++;
+	nl = memchr(data, '\n', size);
+	i = nl ? (size_t)(nl - data) : size;
 
 	w = parse_codefence(data, i, &lang, &width, &chr);
 	if (!w)
 		return 0;
 
-	/* search for end */
+	/* search for end, a line at a time */
 	i++;
 	text_start = i;
 	while ((line_start = i) < size) {
-		while (i < size && data[i] != '\n')
-			i++;
+		nl = memchr(data + i, '\n', size - i);
+		i = nl ? (size_t)(nl - data) : size;
 
 		w2 = is_codefence(data + line_start, i - line_start, &width2, &chr2);
 		if (w == w2 && width == width2 && chr == chr2 &&
@@ -1761,8 +2109,8 @@ parse_fencedcode(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 	text.data = data + text_start;
 	text.size = line_start - text_start;
 
-	if (doc->md.blockcode)
-		doc->md.blockcode(ob, text.size ? &text : NULL, lang.size ? &lang : NULL, &doc->data);
+	if (doc->md->blockcode)
+		doc->md->blockcode(ob, text.size ? &text : NULL, lang.size ? &lang : NULL, &doc->data);
 
 	return i;
 }
@@ -1770,14 +2118,19 @@ parse_fencedcode(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_
 static size_t
 parse_blockcode(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size)
 {
-	size_t beg, end, pre;
+	rfcdown_buffer text = { NULL, 0, 0, 0, NULL, NULL, NULL };
+	size_t beg, end, pre, len, work_size = 0;
+	uint8_t *work_data = 0;
+	const uint8_t *line, *nl;
 	rfcdown_buffer *work = 0;
 
-	work = newbuf(doc, BUFFER_BLOCK);
+	if (doc->shared_text)
+		work = newbuf(doc, BUFFER_BLOCK);
 
 	beg = 0;
 	while (beg < size) {
-		for (end = beg + 1; end < size && data[end - 1] != '\n'; end++) {};
+		nl = memchr(data + beg, '\n', size - beg);
+		end = nl ? (size_t)(nl - data) + 1 : size;
 		pre = prefix_code(data + beg, end - beg);
 
 		if (pre)
@@ -1787,24 +2140,57 @@ parse_blockcode(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 			break;
 
 		if (beg < end) {
-			/* verbatim copy to the working buffer,
-				escaping entities */
-			if (is_empty(data + beg, end - beg))
-				rfcdown_buffer_putc(work, '\n');
-			else rfcdown_buffer_put(work, data + beg, end - beg);
+			line = data + beg;
+			len = end - beg;
+			if (is_empty(line, len)) {
+				line = (const uint8_t *)"\n";
+				len = 1;
+			}
+
+			/* verbatim, without the prefixes, as the blockquotes are */
+			if (work)
+				rfcdown_buffer_put(work, line, len);
+			else {
+				if (!work_data)
+					work_data = data + beg;
+				if (line != work_data + work_size)
+					memmove(work_data + work_size, line, len);
+				work_size += len;
+			}
 		}
 		beg = end;
 	}
 
-	while (work->size && work->data[work->size - 1] == '\n')
-		work->size -= 1;
+	/* in place, the newline after the last line can end the text too,
+	 * unless the block is the end of the text */
+	if (!work) {
+		len = work_size;
+		while (work_size && work_data[work_size - 1] == '\n')
+			work_size--;
 
-	rfcdown_buffer_putc(work, '\n');
+		text.data = work_data;
+		text.size = work_size + 1;
 
-	if (doc->md.blockcode)
-		doc->md.blockcode(ob, work, NULL, &doc->data);
+		if (work_size == len) {
+			work = newbuf(doc, BUFFER_BLOCK);
+			rfcdown_buffer_put(work, work_data, work_size);
+		}
+	}
 
-	popbuf(doc, BUFFER_BLOCK);
+	if (work) {
+		while (work->size && work->data[work->size - 1] == '\n')
+			work->size -= 1;
+
+		rfcdown_buffer_putc(work, '\n');
+		text.data = work->data;
+		text.size = work->size;
+	}
+
+	if (doc->md->blockcode)
+		doc->md->blockcode(ob, &text, NULL, &doc->data);
+
+	if (work)
+		popbuf(doc, BUFFER_BLOCK);
 	return beg;
 }
 
@@ -1864,7 +2250,7 @@ parse_listitem(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 
 		pre = i;
 
-		if (doc->ext_flags & RFCDOWN_EXT_FENCED_CODE) {
+		if (DOC_EXT(doc) & RFCDOWN_EXT_FENCED_CODE) {
 			if (is_codefence(data + beg + i, end - beg - i, NULL, NULL))
 				in_fence = !in_fence;
 		}
@@ -1937,8 +2323,8 @@ parse_listitem(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 	}
 
 	/* render of li itself */
-	if (doc->md.listitem)
-		doc->md.listitem(ob, inter, *flags, &doc->data);
+	if (doc->md->listitem)
+		doc->md->listitem(ob, inter, *flags, &doc->data);
 
 	popbuf(doc, BUFFER_SPAN);
 	popbuf(doc, BUFFER_SPAN);
@@ -1963,8 +2349,8 @@ parse_list(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t size
 			break;
 	}
 
-	if (doc->md.list)
-		doc->md.list(ob, work, flags, &doc->data);
+	if (doc->md->list)
+		doc->md->list(ob, work, flags, &doc->data);
 	popbuf(doc, BUFFER_BLOCK);
 	return i;
 }
@@ -1995,8 +2381,8 @@ parse_atxheader(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 
 		parse_inline(work, doc, data + i, end - i);
 
-		if (doc->md.header)
-			doc->md.header(ob, work, (int)level, &doc->data);
+		if (doc->md->header)
+			doc->md->header(ob, work, (int)level, &doc->data);
 
 		popbuf(doc, BUFFER_SPAN);
 	}
@@ -2013,8 +2399,8 @@ parse_footnote_def(rfcdown_buffer *ob, rfcdown_document *doc, unsigned int num,
 
 	parse_block(work, doc, data, size);
 
-	if (doc->md.footnote_def)
-	doc->md.footnote_def(ob, work, num, &doc->data);
+	if (doc->md->footnote_def)
+	doc->md->footnote_def(ob, work, num, &doc->data);
 	popbuf(doc, BUFFER_SPAN);
 }
 
@@ -2038,8 +2424,8 @@ parse_footnote_list(rfcdown_buffer *ob, rfcdown_document *doc, struct footnote_l
 		item = item->next;
 	}
 
-	if (doc->md.footnotes)
-		doc->md.footnotes(ob, work, &doc->data);
+	if (doc->md->footnotes)
+		doc->md->footnotes(ob, work, &doc->data);
 	popbuf(doc, BUFFER_BLOCK);
 }
 
@@ -2158,8 +2544,8 @@ parse_htmlblock(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 
 			if (j) {
 				work.size = i + j;
-				if (do_render && doc->md.blockhtml)
-					doc->md.blockhtml(ob, &work, &doc->data);
+				if (do_render && doc->md->blockhtml)
+					doc->md->blockhtml(ob, &work, &doc->data);
 				return work.size;
 			}
 		}
@@ -2175,8 +2561,8 @@ parse_htmlblock(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 				j = is_empty(data + i, size - i);
 				if (j) {
 					work.size = i + j;
-					if (do_render && doc->md.blockhtml)
-						doc->md.blockhtml(ob, &work, &doc->data);
+					if (do_render && doc->md->blockhtml)
+						doc->md->blockhtml(ob, &work, &doc->data);
 					return work.size;
 				}
 			}
@@ -2200,12 +2586,134 @@ parse_htmlblock(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t
 
 	/* the end of the block has been found */
 	work.size = tag_end;
-	if (do_render && doc->md.blockhtml)
-		doc->md.blockhtml(ob, &work, &doc->data);
+	if (do_render && doc->md->blockhtml)
+		doc->md->blockhtml(ob, &work, &doc->data);
 
 	return tag_end;
 }
 
+/* table_row: a table row being cut into cells; what find_cell_end looks
+ * for past one cell is kept for the cells after it */
+struct table_row {
+	uint8_t *data;
+	size_t size;
+	struct span_index runs;	/* its backtick runs, listed at the first '`' */
+	size_t pipe_from, pipe_at;	/* the last '|' found, and from where */
+	size_t bracket_from, bracket_at;	/* same for ']' */
+	size_t paren_from, paren_at;	/* same for ')' */
+};
+
+/* find_cell_stop • the first '|', '[' or '`' at or after data[i] */
+static size_t
+find_cell_stop(const uint8_t *data, size_t i, size_t size)
+{
+#if defined(__SSE2__)
+	const __m128i pipe = _mm_set1_epi8('|');
+	const __m128i bracket = _mm_set1_epi8('[');
+	const __m128i tick = _mm_set1_epi8('`');
+
+	for (; i + 16 <= size; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		int mask = _mm_movemask_epi8(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, pipe), _mm_cmpeq_epi8(v, bracket)),
+			_mm_cmpeq_epi8(v, tick)));
+
+		if (mask)
+			return i + __builtin_ctz(mask);
+	}
+#endif
+
+	while (i < size && data[i] != '|' && data[i] != '[' && data[i] != '`')
+		i++;
+
+	return i;
+}
+
+/* find_cell_end • returns the length of the cell starting at data[start]
+ * up to its closing pipe, or 0 if there is none, as find_emph_char does
+ * for '|': pipes in code spans and links don't count, but a span or link
+ * that is never closed gives the first pipe after its opening back. The
+ * closing backticks, brackets and parentheses are looked up in the lists
+ * and memos of the row, so that no cell reads the rest of it again. */
+static size_t
+find_cell_end(rfcdown_document *doc, struct table_row *row, size_t start)
+{
+	uint8_t *data = row->data;
+	size_t size = row->size, i = start, pipe, end, nb, k;
+	struct code_run *runs;
+
+	while (i < size) {
+		i = find_cell_stop(data, i, size);
+
+		if (i >= size)
+			return 0;
+
+		/* not counting escaped chars */
+		if (is_escaped(data, i)) {
+			i++; continue;
+		}
+
+		if (data[i] == '|')
+			return i - start;
+
+		/* the pipe to fall back on if nothing closes what opens here */
+		pipe = find_memo(data, size, '|', i + 1, &row->pipe_from, &row->pipe_at);
+
+		/* skipping a codespan, closed by the first run of as many
+		 * backticks after the opening ones */
+		if (data[i] == '`') {
+			if (!row->runs.code_listed)
+				list_code_runs(doc, &row->runs);
+
+			runs = (struct code_run *)doc->code_runs->data + row->runs.code_first;
+			for (k = row->runs.code_next; runs[k].start + runs[k].size <= i; k++);
+			row->runs.code_next = k;
+
+			end = runs[k].start + runs[k].size;
+			nb = end - i;
+			i = end;
+			if (i >= size)
+				return 0;
+
+			for (k++; k < row->runs.code_count && runs[k].longest >= nb; k++)
+				if (runs[k].size >= nb)
+					break;
+
+			if (k >= row->runs.code_count || runs[k].size < nb)
+				return pipe < size ? pipe - start : 0;
+
+			i = runs[k].start + nb;
+		}
+		/* skipping a link */
+		else {
+			end = find_memo(data, size, ']', i + 1, &row->bracket_from, &row->bracket_at);
+
+			i = end + 1;
+			while (i < size && _isspace(data[i]))
+				i++;
+
+			if (i >= size)
+				return pipe < end ? pipe - start : 0;
+
+			if (data[i] == '[')
+				end = find_memo(data, size, ']', i + 1, &row->bracket_from, &row->bracket_at);
+			else if (data[i] == '(')
+				end = find_memo(data, size, ')', i + 1, &row->paren_from, &row->paren_at);
+			else if (pipe < end)
+				return pipe - start;
+			else
+				continue;
+
+			if (end >= size)
+				return pipe < end ? pipe - start : 0;
+
+			i = end + 1;
+		}
+	}
+
+	return 0;
+}
+
 static void
 parse_table_row(
 	rfcdown_buffer *ob,
@@ -2218,10 +2726,19 @@ parse_table_row(
 {
 	size_t i = 0, col, len;
 	rfcdown_buffer *row_work = 0;
+	struct table_row row;
 
-	if (!doc->md.table_cell || !doc->md.table_row)
+	if (!doc->md->table_cell || !doc->md->table_row)
 		return;
 
+	row.data = data;
+	row.size = size;
+	row.runs.data = data;
+	row.runs.size = size;
+	row.runs.code_listed = 0;
+	row.pipe_from = row.bracket_from = row.paren_from = (size_t)-1;
+	row.pipe_at = row.bracket_at = row.paren_at = 0;
+
 	row_work = newbuf(doc, BUFFER_SPAN);
 
 	if (i < size && data[i] == '|')
@@ -2238,7 +2755,7 @@ parse_table_row(
 
 		cell_start = i;
 
-		len = find_emph_char(data + i, size - i, '|');
+		len = find_cell_end(doc, &row, i);
 
 		/* Two possibilities for len == 0:
 		   1) No more pipe char found in the current line.
@@ -2255,7 +2772,7 @@ parse_table_row(
 			cell_end--;
 
 		parse_inline(cell_work, doc, data + cell_start, 1 + cell_end - cell_start);
-		doc->md.table_cell(row_work, cell_work, col_data[col] | header_flag, &doc->data);
+		doc->md->table_cell(row_work, cell_work, col_data[col] | header_flag, &doc->data);
 
 		popbuf(doc, BUFFER_SPAN);
 		i++;
@@ -2263,12 +2780,15 @@ parse_table_row(
 
 	for (; col < columns; ++col) {
 		rfcdown_buffer empty_cell = { 0, 0, 0, 0, NULL, NULL, NULL };
-		doc->md.table_cell(row_work, &empty_cell, col_data[col] | header_flag, &doc->data);
+		doc->md->table_cell(row_work, &empty_cell, col_data[col] | header_flag, &doc->data);
 	}
 
-	doc->md.table_row(ob, row_work, &doc->data);
+	doc->md->table_row(ob, row_work, &doc->data);
 
 	popbuf(doc, BUFFER_SPAN);
+
+	if (row.runs.code_listed)
+		doc->code_runs->size = row.runs.code_first * sizeof(struct code_run);
 }
 
 static size_t
@@ -2306,7 +2826,13 @@ parse_table_header(
 		return 0;
 
 	*columns = pipes + 1;
-	*column_data = rfcdown_calloc(*columns, sizeof(rfcdown_table_flags));
+
+	/* one array for the columns of every table */
+	if (!doc->table_cols)
+		doc->table_cols = rfcdown_buffer_new(16 * sizeof(rfcdown_table_flags));
+	rfcdown_buffer_grow(doc->table_cols, *columns * sizeof(rfcdown_table_flags));
+	*column_data = (rfcdown_table_flags *)doc->table_cols->data;
+	memset(*column_data, 0x0, *columns * sizeof(rfcdown_table_flags));
 
 	/* Parse the header underline */
 	i++;
@@ -2413,17 +2939,16 @@ parse_table(
 			i++;
 		}
 
-        if (doc->md.table_header)
-            doc->md.table_header(work, header_work, &doc->data);
+        if (doc->md->table_header)
+            doc->md->table_header(work, header_work, &doc->data);
 
-        if (doc->md.table_body)
-            doc->md.table_body(work, body_work, &doc->data);
+        if (doc->md->table_body)
+            doc->md->table_body(work, body_work, &doc->data);
 
-		if (doc->md.table)
-			doc->md.table(ob, work, &doc->data);
+		if (doc->md->table)
+			doc->md->table(ob, work, &doc->data);
 	}
 
-	free(col_data);
 	popbuf(doc, BUFFER_SPAN);
 	popbuf(doc, BUFFER_BLOCK);
 	popbuf(doc, BUFFER_BLOCK);
@@ -2436,29 +2961,36 @@ parse_block(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 {
 	size_t beg, end, i;
 	uint8_t *txt_data;
+	unsigned int start;
 	beg = 0;
 
 	if (doc->work_bufs[BUFFER_SPAN].size +
 		doc->work_bufs[BUFFER_BLOCK].size > doc->max_nesting)
 		return;
 
-	while (beg < size) {
+	/* nested blocks never reach block_limit, which only stops the top level */
+	while (beg < size && beg < doc->block_limit) {
 		txt_data = data + beg;
 		end = size - beg;
 
-		if (is_atxheader(doc, txt_data, end))
+		if (doc->block_marks)
+			rfcdown_buffer_put(doc->block_marks, (const uint8_t *)&beg, sizeof(beg));
+
+		start = block_start(txt_data, end);
+
+		if (start & BLOCK_ATX && is_atxheader(doc, txt_data, end))
 			beg += parse_atxheader(ob, doc, txt_data, end);
 
-		else if (data[beg] == '<' && doc->md.blockhtml &&
+		else if (start & BLOCK_HTML && doc->md->blockhtml &&
 				(i = parse_htmlblock(ob, doc, txt_data, end, 1)) != 0)
 			beg += i;
 
-		else if ((i = is_empty(txt_data, end)) != 0)
+		else if (start & BLOCK_EMPTY && (i = is_empty(txt_data, end)) != 0)
 			beg += i;
 
-		else if (is_hrule(txt_data, end)) {
-			if (doc->md.hrule)
-				doc->md.hrule(ob, &doc->data);
+		else if (start & BLOCK_HRULE && is_hrule(txt_data, end)) {
+			if (doc->md->hrule)
+				doc->md->hrule(ob, &doc->data);
 
 			while (beg < size && data[beg] != '\n')
 				beg++;
@@ -2466,24 +2998,24 @@ parse_block(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 			beg++;
 		}
 
-		else if ((doc->ext_flags & RFCDOWN_EXT_FENCED_CODE) != 0 &&
+		else if (start & BLOCK_FENCE && (DOC_EXT(doc) & RFCDOWN_EXT_FENCED_CODE) != 0 &&
 			(i = parse_fencedcode(ob, doc, txt_data, end)) != 0)
 			beg += i;
 
-		else if ((doc->ext_flags & RFCDOWN_EXT_TABLES) != 0 &&
+		else if ((DOC_EXT(doc) & RFCDOWN_EXT_TABLES) != 0 &&
 			(i = parse_table(ob, doc, txt_data, end)) != 0)
 			beg += i;
 
-		else if (prefix_quote(txt_data, end))
+		else if (start & BLOCK_QUOTE && prefix_quote(txt_data, end))
 			beg += parse_blockquote(ob, doc, txt_data, end);
 
-		else if (!(doc->ext_flags & RFCDOWN_EXT_DISABLE_INDENTED_CODE) && prefix_code(txt_data, end))
+		else if (start & BLOCK_CODE && !(DOC_EXT(doc) & RFCDOWN_EXT_DISABLE_INDENTED_CODE) && prefix_code(txt_data, end))
 			beg += parse_blockcode(ob, doc, txt_data, end);
 
-		else if (prefix_uli(txt_data, end))
+		else if (start & BLOCK_ULI && prefix_uli(txt_data, end))
 			beg += parse_list(ob, doc, txt_data, end, 0);
 
-		else if (prefix_oli(txt_data, end))
+		else if (start & BLOCK_OLI && prefix_oli(txt_data, end))
 			beg += parse_list(ob, doc, txt_data, end, RFCDOWN_LIST_ORDERED);
 
 		else
@@ -2493,91 +3025,318 @@ parse_block(rfcdown_buffer *ob, rfcdown_document *doc, uint8_t *data, size_t siz
 
 
 
+#ifdef RFCDOWN_SPEC_ONLY
+
+/* the specialized parser only provides the parsing entry points;
+ * everything below is compiled once, in the generic document.o */
+const struct parser_entry rfcdown_document__spec_parser = {
+	parse_block, parse_inline, parse_footnote_list
+};
+
+#else
+
+static const struct parser_entry generic_parser = {
+	parse_block, parse_inline, parse_footnote_list
+};
+
+#ifdef RFCDOWN_SPEC_EXT
+extern const struct parser_entry rfcdown_document__spec_parser;
+#endif
+
 /*********************
  * REFERENCE PARSING *
  *********************/
 
-/* is_footnote • returns whether a line is a footnote definition or not */
-static int
-is_footnote(const uint8_t *data, size_t beg, size_t end, size_t *last, struct footnote_list *list)
-{
-	size_t i = 0;
-	rfcdown_buffer *contents = 0;
-	size_t ind = 0;
-	int in_empty = 0;
-	size_t start = 0;
+#define BUFFER_ASIZE(b) ((b) ? (b)->asize : 0)
 
-	size_t id_offset, id_end;
+static struct link_ref *
+add_link_ref(rfcdown_document *doc, const uint8_t *name, size_t name_size)
+{
+	struct link_ref **references = doc->refs;
+	struct link_ref *ref = doc->spare_refs;
 
-	/* up to 3 optional leading spaces */
-	if (beg + 3 >= end) return 0;
-	if (data[beg] == ' ') { i = 1;
-	if (data[beg + 1] == ' ') { i = 2;
-	if (data[beg + 2] == ' ') { i = 3;
-	if (data[beg + 3] == ' ') return 0; } } }
-	i += beg;
+	if (ref)
+		doc->spare_refs = ref->next;
+	else
+		ref = rfcdown_calloc(1, sizeof(struct link_ref));
 
-	/* id part: caret followed by anything between brackets */
-	if (data[i] != '[') return 0;
-	i++;
-	if (i >= end || data[i] != '^') return 0;
-	i++;
-	id_offset = i;
-	while (i < end && data[i] != '\n' && data[i] != '\r' && data[i] != ']')
-		i++;
-	if (i >= end || data[i] != ']') return 0;
-	id_end = i;
+	ref->id = hash_link_ref(name, name_size);
+	ref->next = references[ref->id % REF_TABLE_SIZE];
 
-	/* spacer: colon (space | tab)* newline? (space | tab)* */
-	i++;
-	if (i >= end || data[i] != ':') return 0;
-	i++;
+	references[ref->id % REF_TABLE_SIZE] = ref;
+	return ref;
+}
 
-	/* getting content buffer */
-	contents = rfcdown_buffer_new(64);
+static void
+free_link_ref(struct link_ref *ref)
+{
+	rfcdown_buffer_free(ref->link);
+	rfcdown_buffer_free(ref->title_buf);
+	rfcdown_buffer_free(ref->href_memo);
+	free(ref);
+}
 
-	start = i;
+/* release_link_refs • empties the references table into the spare list */
+static void
+release_link_refs(rfcdown_document *doc)
+{
+	size_t i;
 
-	/* process lines similar to a list item */
-	while (i < end) {
-		while (i < end && data[i] != '\n' && data[i] != '\r') i++;
+	for (i = 0; i < REF_TABLE_SIZE; ++i) {
+		struct link_ref *r = doc->refs[i];
+		struct link_ref *next;
 
-		/* process an empty line */
-		if (is_empty(data + start, i - start)) {
-			in_empty = 1;
-			if (i < end && (data[i] == '\n' || data[i] == '\r')) {
-				i++;
-				if (i < end && data[i] == '\n' && data[i - 1] == '\r') i++;
-			}
-			start = i;
-			continue;
+		while (r) {
+			next = r->next;
+			if (r->link) r->link->size = 0;
+			if (r->title_buf) r->title_buf->size = 0;
+			if (r->href_memo) r->href_memo->size = 0;
+			r->title = NULL;
+			r->next = doc->spare_refs;
+			doc->spare_refs = r;
+			r = next;
 		}
 
-		/* calculating the indentation */
-		ind = 0;
-		while (ind < 4 && start + ind < end && data[start + ind] == ' ')
-			ind++;
+		doc->refs[i] = NULL;
+	}
+}
 
-		/* joining only indented stuff after empty lines;
-		 * note that now we only require 1 space of indentation
-		 * to continue, just like lists */
-		if (ind == 0) {
-			if (start == id_end + 2 && data[start] == '\t') {}
-			else break;
-		}
-		else if (in_empty) {
-			rfcdown_buffer_putc(contents, '\n');
-		}
+static struct footnote_ref *
+create_footnote_ref(rfcdown_document *doc, const uint8_t *name, size_t name_size)
+{
+	struct footnote_ref *ref = rfcdown_stack_pop(&doc->spare_footnotes);
 
-		in_empty = 0;
+	if (ref) {
+		ref->is_used = 0;
+		ref->num = 0;
+		ref->contents->size = 0;
+	} else {
+		ref = rfcdown_calloc(1, sizeof(struct footnote_ref));
+		ref->contents = rfcdown_buffer_new(64);
+	}
 
-		/* adding the line into the content buffer */
-		rfcdown_buffer_put(contents, data + start + ind, i - start - ind);
-		/* add carriage return */
-		if (i < end) {
-			rfcdown_buffer_putc(contents, '\n');
-			if (i < end && (data[i] == '\n' || data[i] == '\r')) {
-				i++;
+	ref->id = hash_link_ref(name, name_size);
+
+	return ref;
+}
+
+static void
+free_footnote_ref(struct footnote_ref *ref)
+{
+	rfcdown_buffer_free(ref->contents);
+	free(ref);
+}
+
+/* release_footnote_list • empties a list into the spare items, and its
+ * footnotes into the spare footnotes when they are owned by the list */
+static void
+release_footnote_list(rfcdown_document *doc, struct footnote_list *list, int owns_refs)
+{
+	struct footnote_item *item = list->head;
+	struct footnote_item *next;
+
+	while (item) {
+		next = item->next;
+		if (owns_refs)
+			rfcdown_stack_push(&doc->spare_footnotes, item->ref);
+		item->ref = NULL;
+		item->next = doc->spare_items;
+		doc->spare_items = item;
+		item = next;
+	}
+
+	memset(list, 0x0, sizeof(*list));
+}
+
+/* warm_size • bytes kept by the document between renders */
+static size_t
+warm_size(rfcdown_document *doc)
+{
+	size_t total = BUFFER_ASIZE(doc->text) +
+		BUFFER_ASIZE(doc->code_runs) + BUFFER_ASIZE(doc->table_cols);
+	struct link_ref *r;
+	struct footnote_item *item;
+	struct footnote_ref *fr;
+	size_t i, t;
+
+	for (r = doc->spare_refs; r; r = r->next)
+		total += sizeof(*r) + BUFFER_ASIZE(r->link) +
+			BUFFER_ASIZE(r->title_buf) + BUFFER_ASIZE(r->href_memo);
+
+	for (item = doc->spare_items; item; item = item->next)
+		total += sizeof(*item);
+
+	for (i = 0; i < doc->spare_footnotes.size; ++i) {
+		fr = doc->spare_footnotes.item[i];
+		total += sizeof(*fr) + BUFFER_ASIZE(fr->contents);
+	}
+
+	for (t = 0; t < 2; ++t)
+		for (i = 0; i < doc->work_bufs[t].asize; ++i)
+			total += BUFFER_ASIZE((rfcdown_buffer *)doc->work_bufs[t].item[i]);
+
+	return total;
+}
+
+/* trim_warm_state • frees warm state until at most `keep` bytes remain:
+ * spare references and footnotes first, then the backtick runs, the
+ * table columns and the text buffer, then the deepest work buffers */
+static void
+trim_warm_state(rfcdown_document *doc, size_t keep)
+{
+	size_t total = warm_size(doc);
+	struct link_ref *r;
+	struct footnote_item *item;
+	struct footnote_ref *fr;
+	size_t i, t;
+
+	if (total <= keep)
+		return;
+
+	while (total > keep && (r = doc->spare_refs) != NULL) {
+		doc->spare_refs = r->next;
+		total -= sizeof(*r) + BUFFER_ASIZE(r->link) +
+			BUFFER_ASIZE(r->title_buf) + BUFFER_ASIZE(r->href_memo);
+		free_link_ref(r);
+	}
+
+	while (total > keep && (item = doc->spare_items) != NULL) {
+		doc->spare_items = item->next;
+		total -= sizeof(*item);
+		free(item);
+	}
+
+	while (total > keep && (fr = rfcdown_stack_pop(&doc->spare_footnotes)) != NULL) {
+		total -= sizeof(*fr) + BUFFER_ASIZE(fr->contents);
+		free_footnote_ref(fr);
+	}
+
+	if (total > keep && doc->code_runs) {
+		total -= doc->code_runs->asize;
+		rfcdown_buffer_free(doc->code_runs);
+		doc->code_runs = NULL;
+	}
+
+	if (total > keep && doc->table_cols) {
+		total -= doc->table_cols->asize;
+		rfcdown_buffer_free(doc->table_cols);
+		doc->table_cols = NULL;
+	}
+
+	if (total > keep && doc->text) {
+		total -= doc->text->asize;
+		rfcdown_buffer_free(doc->text);
+		doc->text = NULL;
+	}
+
+	for (t = 0; t < 2; ++t) {
+		rfcdown_stack *pool = &doc->work_bufs[t];
+
+		for (i = pool->asize; total > keep && i > pool->size; --i) {
+			rfcdown_buffer *work = pool->item[i - 1];
+
+			if (work) {
+				total -= work->asize;
+				rfcdown_buffer_free(work);
+				pool->item[i - 1] = NULL;
+			}
+		}
+	}
+}
+
+/* put_def_part • appends a part of a definition to defs, after its size,
+ * so that the parts of two definitions never read as those of one */
+static void
+put_def_part(rfcdown_buffer *defs, const uint8_t *data, size_t size)
+{
+	rfcdown_buffer_put(defs, (const uint8_t *)&size, sizeof(size_t));
+	rfcdown_buffer_put(defs, data, size);
+}
+
+/* is_footnote • returns whether a line is a footnote definition or not;
+ * its id and contents are appended to defs when given */
+static int
+is_footnote(rfcdown_document *doc, const uint8_t *data, size_t beg, size_t end, size_t *last, struct footnote_list *list, rfcdown_buffer *defs)
+{
+	size_t i = 0;
+	struct footnote_ref *ref;
+	rfcdown_buffer *contents = 0;
+	size_t ind = 0;
+	int in_empty = 0;
+	size_t start = 0;
+
+	size_t id_offset, id_end;
+
+	/* up to 3 optional leading spaces */
+	if (beg + 3 >= end) return 0;
+	if (data[beg] == ' ') { i = 1;
+	if (data[beg + 1] == ' ') { i = 2;
+	if (data[beg + 2] == ' ') { i = 3;
+	if (data[beg + 3] == ' ') return 0; } } }
+	i += beg;
+
+	/* id part: caret followed by anything between brackets */
+	if (data[i] != '[') return 0;
+	i++;
+	if (i >= end || data[i] != '^') return 0;
+	i++;
+	id_offset = i;
+	while (i < end && data[i] != '\n' && data[i] != '\r' && data[i] != ']')
+		i++;
+	if (i >= end || data[i] != ']') return 0;
+	id_end = i;
+
+	/* spacer: colon (space | tab)* newline? (space | tab)* */
+	i++;
+	if (i >= end || data[i] != ':') return 0;
+	i++;
+
+	/* getting content buffer */
+	ref = create_footnote_ref(doc, data + id_offset, id_end - id_offset);
+	contents = ref->contents;
+
+	start = i;
+
+	/* process lines similar to a list item */
+	while (i < end) {
+		while (i < end && data[i] != '\n' && data[i] != '\r') i++;
+
+		/* process an empty line */
+		if (is_empty(data + start, i - start)) {
+			in_empty = 1;
+			if (i < end && (data[i] == '\n' || data[i] == '\r')) {
+				i++;
+				if (i < end && data[i] == '\n' && data[i - 1] == '\r') i++;
+			}
+			start = i;
+			continue;
+		}
+
+		/* calculating the indentation */
+		ind = 0;
+		while (ind < 4 && start + ind < end && data[start + ind] == ' ')
+			ind++;
+
+		/* joining only indented stuff after empty lines;
+		 * note that now we only require 1 space of indentation
+		 * to continue, just like lists */
+		if (ind == 0) {
+			if (start == id_end + 2 && data[start] == '\t') {}
+			else break;
+		}
+		else if (in_empty) {
+			rfcdown_buffer_putc(contents, '\n');
+		}
+
+		in_empty = 0;
+
+		/* adding the line into the content buffer */
+		rfcdown_buffer_put(contents, data + start + ind, i - start - ind);
+		/* add carriage return */
+		if (i < end) {
+			rfcdown_buffer_putc(contents, '\n');
+			if (i < end && (data[i] == '\n' || data[i] == '\r')) {
+				i++;
 				if (i < end && data[i] == '\n' && data[i - 1] == '\r') i++;
 			}
 		}
@@ -2587,24 +3346,26 @@ is_footnote(const uint8_t *data, size_t beg, size_t end, size_t *last, struct fo
 	if (last)
 		*last = start;
 
-	if (list) {
-		struct footnote_ref *ref;
-		ref = create_footnote_ref(list, data + id_offset, id_end - id_offset);
-		if (!ref)
-			return 0;
-		if (!add_footnote_ref(list, ref)) {
-			free_footnote_ref(ref);
-			return 0;
-		}
-		ref->contents = contents;
+	if (!list) {
+		rfcdown_stack_push(&doc->spare_footnotes, ref);
+	} else if (!add_footnote_ref(doc, list, ref)) {
+		free_footnote_ref(ref);
+		return 0;
+	}
+
+	if (defs) {
+		rfcdown_buffer_putc(defs, '^');
+		put_def_part(defs, data + id_offset, id_end - id_offset);
+		put_def_part(defs, contents->data, contents->size);
 	}
 
 	return 1;
 }
 
-/* is_ref • returns whether a line is a reference or not */
+/* is_ref • returns whether a line is a reference or not; what is stored
+ * of it is appended to defs when given */
 static int
-is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_ref **refs)
+is_ref(rfcdown_document *doc, const uint8_t *data, size_t beg, size_t end, size_t *last, int store, rfcdown_buffer *defs)
 {
 /*	int n; */
 	size_t i = 0;
@@ -2697,20 +3458,34 @@ is_ref(const uint8_t *data, size_t beg, size_t end, size_t *last, struct link_re
 	if (last)
 		*last = line_end;
 
-	if (refs) {
+	if (store) {
+		rfcdown_buffer link = { NULL, 0, 0, 0, NULL, NULL, NULL };
 		struct link_ref *ref;
 
-		ref = add_link_ref(refs, data + id_offset, id_end - id_offset);
+		ref = add_link_ref(doc, data + id_offset, id_end - id_offset);
 		if (!ref)
 			return 0;
 
-		ref->link = rfcdown_buffer_new(link_end - link_offset);
-		rfcdown_buffer_put(ref->link, data + link_offset, link_end - link_offset);
+		/* the link is stored unescaped, as every use needs it that way */
+		link.data = (uint8_t *)data + link_offset;
+		link.size = link_end - link_offset;
+		if (!ref->link)
+			ref->link = rfcdown_buffer_new(link.size);
+		unscape_text(ref->link, &link);
 
 		if (title_end > title_offset) {
-			ref->title = rfcdown_buffer_new(title_end - title_offset);
+			if (!ref->title_buf)
+				ref->title_buf = rfcdown_buffer_new(title_end - title_offset);
+			ref->title = ref->title_buf;
 			rfcdown_buffer_put(ref->title, data + title_offset, title_end - title_offset);
 		}
+
+		if (defs) {
+			rfcdown_buffer_putc(defs, '[');
+			put_def_part(defs, data + id_offset, id_end - id_offset);
+			put_def_part(defs, data + link_offset, link_end - link_offset);
+			put_def_part(defs, data + title_offset, title_end > title_offset ? title_end - title_offset : 0);
+		}
 	}
 
 	return 1;
@@ -2750,81 +3525,11 @@ static void expand_tabs(rfcdown_buffer *ob, const uint8_t *line, size_t size)
 	}
 }
 
-/**********************
- * EXPORTED FUNCTIONS *
- **********************/
-
-rfcdown_document *
-rfcdown_document_new(
-	const rfcdown_renderer *renderer,
-	rfcdown_extensions extensions,
-	size_t max_nesting)
-{
-	rfcdown_document *doc = NULL;
-
-	assert(max_nesting > 0 && renderer);
-
-	doc = rfcdown_malloc(sizeof(rfcdown_document));
-	memcpy(&doc->md, renderer, sizeof(rfcdown_renderer));
-
-	doc->data.opaque = renderer->opaque;
-
-	rfcdown_stack_init(&doc->work_bufs[BUFFER_BLOCK], 4);
-	rfcdown_stack_init(&doc->work_bufs[BUFFER_SPAN], 8);
-
-	memset(doc->active_char, 0x0, 256);
-
-	if (extensions & RFCDOWN_EXT_UNDERLINE && doc->md.underline) {
-		doc->active_char['_'] = MD_CHAR_EMPHASIS;
-	}
-
-	if (doc->md.emphasis || doc->md.double_emphasis || doc->md.triple_emphasis) {
-		doc->active_char['*'] = MD_CHAR_EMPHASIS;
-		doc->active_char['_'] = MD_CHAR_EMPHASIS;
-		if (extensions & RFCDOWN_EXT_STRIKETHROUGH)
-			doc->active_char['~'] = MD_CHAR_EMPHASIS;
-		if (extensions & RFCDOWN_EXT_HIGHLIGHT)
-			doc->active_char['='] = MD_CHAR_EMPHASIS;
-	}
-
-	if (doc->md.codespan)
-		doc->active_char['`'] = MD_CHAR_CODESPAN;
-
-	if (doc->md.linebreak)
-		doc->active_char['\n'] = MD_CHAR_LINEBREAK;
-
-	if (doc->md.image || doc->md.link || doc->md.footnotes || doc->md.footnote_ref)
-		doc->active_char['['] = MD_CHAR_LINK;
-
-	doc->active_char['<'] = MD_CHAR_LANGLE;
-	doc->active_char['\\'] = MD_CHAR_ESCAPE;
-	doc->active_char['&'] = MD_CHAR_ENTITY;
-
-	if (extensions & RFCDOWN_EXT_AUTOLINK) {
-		doc->active_char[':'] = MD_CHAR_AUTOLINK_URL;
-		doc->active_char['@'] = MD_CHAR_AUTOLINK_EMAIL;
-		doc->active_char['w'] = MD_CHAR_AUTOLINK_WWW;
-	}
-
-	if (extensions & RFCDOWN_EXT_SUPERSCRIPT)
-		doc->active_char['^'] = MD_CHAR_SUPERSCRIPT;
-
-	if (extensions & RFCDOWN_EXT_QUOTE)
-		doc->active_char['"'] = MD_CHAR_QUOTE;
-
-	if (extensions & RFCDOWN_EXT_MATH)
-		doc->active_char['$'] = MD_CHAR_MATH;
-
-	/* Extension data */
-	doc->ext_flags = extensions;
-	doc->max_nesting = max_nesting;
-	doc->in_link_body = 0;
-
-	return doc;
-}
-
-void
-rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size)
+/* prepare_text • first pass of a render: collects the references and
+ * footnotes, copying everything else into doc->text; what each definition
+ * holds is appended to `defs` when given */
+static void
+prepare_text(rfcdown_document *doc, const uint8_t *data, size_t size, rfcdown_buffer *defs)
 {
 	static const uint8_t UTF8_BOM[] = {0xEF, 0xBB, 0xBF};
 
@@ -2833,7 +3538,10 @@ rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t
 
 	int footnotes_enabled;
 
-	text = rfcdown_buffer_new(64);
+	if (!doc->text)
+		doc->text = rfcdown_buffer_new(64);
+	text = doc->text;
+	text->size = 0;
 
 	/* Preallocate enough space for our buffer to avoid expanding while copying */
 	rfcdown_buffer_grow(text, size);
@@ -2858,10 +3566,10 @@ rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t
 		beg += 3;
 
 	while (beg < size) /* iterating over lines */
-		if (footnotes_enabled && is_footnote(data, beg, size, &end, &doc->footnotes_found))
-			beg = end;
-		else if (is_ref(data, beg, size, &end, doc->refs))
+		if ((footnotes_enabled && is_footnote(doc, data, beg, size, &end, &doc->footnotes_found, defs)) ||
+			is_ref(doc, data, beg, size, &end, 1, defs)) {
 			beg = end;
+		}
 		else { /* skipping to the next line */
 			end = beg;
 			while (end < size && data[end] != '\n' && data[end] != '\r')
@@ -2881,45 +3589,775 @@ rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t
 			beg = end;
 		}
 
-	/* pre-grow the output buffer to minimize allocations */
-	rfcdown_buffer_grow(ob, text->size + (text->size >> 1));
+	/* adding a final newline if not already present */
+	if (text->size && text->data[text->size - 1] != '\n' &&  text->data[text->size - 1] != '\r')
+		rfcdown_buffer_putc(text, '\n');
 
-	/* second pass: actual rendering */
-	if (doc->md.doc_header)
-		doc->md.doc_header(ob, 0, &doc->data);
+	if (doc->phase_callback)
+		doc->phase_callback(doc->phase_opaque, RFCDOWN_PHASE_PREPARE, size);
+}
 
-	if (text->size) {
-		/* adding a final newline if not already present */
-		if (text->data[text->size - 1] != '\n' &&  text->data[text->size - 1] != '\r')
-			rfcdown_buffer_putc(text, '\n');
+/* finish_render • renders the footnotes and the document footer, and
+ * releases what the render collected */
+static void
+finish_render(rfcdown_buffer *ob, rfcdown_document *doc)
+{
+	int footnotes_enabled = doc->ext_flags & RFCDOWN_EXT_FOOTNOTES;
+	size_t rendered = ob->size;
 
-		parse_block(ob, doc, text->data, text->size);
-	}
+	if (doc->phase_callback)
+		doc->phase_callback(doc->phase_opaque, RFCDOWN_PHASE_RENDER, doc->text->size);
 
 	/* footnotes */
 	if (footnotes_enabled)
-		parse_footnote_list(ob, doc, &doc->footnotes_used);
+		doc->parser->footnotes(ob, doc, &doc->footnotes_used);
 
-	if (doc->md.doc_footer)
-		doc->md.doc_footer(ob, 0, &doc->data);
+	if (doc->md->doc_footer)
+		doc->md->doc_footer(ob, 0, &doc->data);
 
 	/* clean-up */
-	rfcdown_buffer_free(text);
-	free_link_refs(doc->refs);
+	release_link_refs(doc);
 	if (footnotes_enabled) {
-		free_footnote_list(&doc->footnotes_found, 1);
-		free_footnote_list(&doc->footnotes_used, 0);
+		release_footnote_list(doc, &doc->footnotes_found, 1);
+		release_footnote_list(doc, &doc->footnotes_used, 0);
 	}
+	trim_warm_state(doc, doc->retention);
 
 	assert(doc->work_bufs[BUFFER_SPAN].size == 0);
 	assert(doc->work_bufs[BUFFER_BLOCK].size == 0);
+
+	if (doc->phase_callback)
+		doc->phase_callback(doc->phase_opaque, RFCDOWN_PHASE_FOOTNOTES, ob->size - rendered);
+}
+
+/**********************
+ * PARALLEL RENDERING *
+ **********************/
+
+/* chunk: a run of top-level blocks rendered on its own */
+struct chunk {
+	size_t beg, end;
+	size_t look;	/* end of the line after the chunk, which may change its last block */
+	unsigned int headers;	/* numbered headers in, then before, the chunk */
+	void *state;
+	rfcdown_buffer *out;
+	int seeded;	/* out starts with a placeholder byte */
+};
+
+/* chunk_job: the chunks of one render, shared by its workers */
+struct chunk_job {
+	rfcdown_document *doc;
+	const rfcdown_config *config;
+	struct chunk *chunks;
+	size_t count;
+	size_t next;
+	int levels;	/* counting headers up to this level, else rendering */
+#ifdef RFCDOWN_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+/* header_counter: renderer state of the counting configuration */
+struct header_counter {
+	int levels;
+	unsigned int count;
+};
+
+static void
+count_header(rfcdown_buffer *ob, const rfcdown_buffer *content, int level, const rfcdown_renderer_data *data)
+{
+	struct header_counter *counter = data->opaque;
+
+	if (level <= counter->levels)
+		counter->count++;
+}
+
+static void
+skip_blockcode(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_buffer *lang, const rfcdown_renderer_data *data)
+{
+}
+
+static void
+skip_block(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+}
+
+static void
+skip_hrule(rfcdown_buffer *ob, const rfcdown_renderer_data *data)
+{
+}
+
+static void
+skip_list(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_list_flags flags, const rfcdown_renderer_data *data)
+{
+}
+
+static void
+skip_table_cell(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_table_flags flags, const rfcdown_renderer_data *data)
+{
+}
+
+/* counting_config • a configuration splitting blocks exactly like the
+ * document's own (block callbacks set alike), that only counts headers */
+static rfcdown_config *
+counting_config(const rfcdown_document *doc)
+{
+	const rfcdown_renderer *md = doc->md;
+	rfcdown_renderer counter;
+	rfcdown_config *config;
+
+	memset(&counter, 0x0, sizeof(counter));
+
+	if (md->blockcode) counter.blockcode = skip_blockcode;
+	if (md->blockquote) counter.blockquote = skip_block;
+	if (md->header) counter.header = count_header;
+	if (md->hrule) counter.hrule = skip_hrule;
+	if (md->list) counter.list = skip_list;
+	if (md->listitem) counter.listitem = skip_list;
+	if (md->paragraph) counter.paragraph = skip_block;
+	if (md->table) counter.table = skip_block;
+	if (md->table_header) counter.table_header = skip_block;
+	if (md->table_body) counter.table_body = skip_block;
+	if (md->table_row) counter.table_row = skip_block;
+	if (md->table_cell) counter.table_cell = skip_table_cell;
+	if (md->blockhtml) counter.blockhtml = skip_block;
+
+	/* spans don't matter to blocks: their text is copied verbatim */
+	config = rfcdown_config_new(&counter, doc->ext_flags, doc->max_nesting);
+	memset(config->active_char, 0x0, sizeof(config->active_char));
+
+	return config;
+}
+
+/* split_chunks • cuts doc->text at top-level block boundaries into chunks
+ * of at least `target` bytes (one per block for 0), returning how many */
+static size_t
+split_chunks(rfcdown_document *doc, const rfcdown_config *config, size_t target, struct chunk **chunks)
+{
+	rfcdown_buffer *text = doc->text;
+	struct header_counter counter = { 0, 0 };
+	rfcdown_document *scan = rfcdown_document_new_from_config(config, &counter);
+	rfcdown_buffer *marks = rfcdown_buffer_new(64 * sizeof(size_t));
+	size_t i, n, mark, beg = 0, count = 0;
+
+	/* with no nesting allowed, only the top-level blocks are parsed at all */
+	scan->max_nesting = 0;
+	scan->block_marks = marks;
+	scan->shared_text = 1;
+	scan->parser->block(marks, scan, text->data, text->size);
+
+	/* block callbacks wrote nothing: marks only holds the offsets */
+	n = marks->size / sizeof(size_t);
+	*chunks = rfcdown_calloc(n + 1, sizeof(struct chunk));
+
+	for (i = 0; i < n; ++i) {
+		memcpy(&mark, marks->data + i * sizeof(size_t), sizeof(size_t));
+		if (mark > beg && mark - beg >= target) {
+			(*chunks)[count].beg = beg;
+			(*chunks)[count].end = mark;
+			count++;
+			beg = mark;
+		}
+	}
+
+	if (beg < text->size) {
+		(*chunks)[count].beg = beg;
+		(*chunks)[count].end = text->size;
+		count++;
+	}
+
+	/* e.g. whether a list item is followed by another after a blank line */
+	for (i = 0; i < count; ++i) {
+		mark = (*chunks)[i].end;
+		while (mark < text->size && text->data[mark] != '\n')
+			mark++;
+		(*chunks)[i].look = mark < text->size ? mark + 1 : mark;
+	}
+
+	rfcdown_buffer_free(marks);
+	rfcdown_document_free(scan);
+	return count;
+}
+
+/* render_chunk • parses a chunk with the given document; the blocks see
+ * the text after the chunk, as they would in a whole render, and leave it
+ * intact for the other chunks */
+static void
+render_chunk(rfcdown_buffer *ob, rfcdown_document *doc, rfcdown_buffer *text, const struct chunk *c)
+{
+	doc->block_limit = c->end - c->beg;
+	doc->shared_text = 1;
+	doc->parser->block(ob, doc, text->data + c->beg, text->size - c->beg);
+	doc->shared_text = 0;
+	doc->block_limit = (size_t)-1;
+}
+
+static struct chunk *
+next_chunk(struct chunk_job *job)
+{
+	struct chunk *c = NULL;
+
+#ifdef RFCDOWN_THREADS
+	pthread_mutex_lock(&job->lock);
+#endif
+	if (job->next < job->count)
+		c = &job->chunks[job->next++];
+#ifdef RFCDOWN_THREADS
+	pthread_mutex_unlock(&job->lock);
+#endif
+
+	return c;
+}
+
+static void *
+chunk_worker(void *opaque)
+{
+	struct chunk_job *job = opaque;
+	rfcdown_document *w = rfcdown_document_new_from_config(job->config, NULL);
+	rfcdown_buffer *sink = rfcdown_buffer_new(64);
+	struct header_counter counter;
+	struct chunk *c;
+
+	/* the references are read by every worker */
+	memcpy(w->refs, job->doc->refs, sizeof(w->refs));
+	w->shared_refs = 1;
+
+	while ((c = next_chunk(job)) != NULL) {
+		if (job->levels > 0) {
+			counter.levels = job->levels;
+			counter.count = 0;
+			w->data.opaque = &counter;
+			sink->size = 0;
+			render_chunk(sink, w, job->doc->text, c);
+			c->headers = counter.count;
+		} else {
+			w->data.opaque = c->state;
+			c->out = rfcdown_buffer_new(64);
+			rfcdown_buffer_grow(c->out, c->end - c->beg + ((c->end - c->beg) >> 1));
+			if (c->seeded)
+				rfcdown_buffer_putc(c->out, '\n');
+			render_chunk(c->out, w, job->doc->text, c);
+		}
+	}
+
+	memset(w->refs, 0x0, sizeof(w->refs));
+	rfcdown_document_free(w);
+	rfcdown_buffer_free(sink);
+	return NULL;
+}
+
+static void
+run_chunk_job(struct chunk_job *job, unsigned int threads)
+{
+#ifdef RFCDOWN_THREADS
+	pthread_t *workers;
+	unsigned int i, started = 0;
+
+	if (threads > job->count)
+		threads = (unsigned int)job->count;
+
+	workers = rfcdown_malloc(threads * sizeof(pthread_t));
+	job->next = 0;
+	pthread_mutex_init(&job->lock, NULL);
+
+	/* the calling thread is a worker as well */
+	for (i = 1; i < threads; ++i)
+		if (pthread_create(&workers[started], NULL, chunk_worker, job) == 0)
+			started++;
+
+	chunk_worker(job);
+
+	for (i = 0; i < started; ++i)
+		pthread_join(workers[i], NULL);
+
+	pthread_mutex_destroy(&job->lock);
+	free(workers);
+#else
+	job->next = 0;
+	chunk_worker(job);
+#endif
+}
+
+/* render_chunks • renders doc->text as chunks of top-level blocks over
+ * several threads; returns 0 when it must be rendered sequentially */
+static int
+render_chunks(rfcdown_buffer *ob, rfcdown_document *doc, const rfcdown_chunk_hooks *hooks, unsigned int threads)
+{
+	void *opaque = doc->data.opaque;
+	rfcdown_config *counting;
+	struct chunk_job job;
+	struct chunk *chunks = NULL;
+	size_t i, count, target;
+	unsigned int headers = 0, in_chunk;
+
+	/* footnotes are numbered in order of use over the whole document */
+	if (!hooks || threads < 2 || doc->footnotes_found.count > 0 ||
+		doc->text->size < 2 * PARALLEL_MIN_CHUNK)
+		return 0;
+
+	target = doc->text->size / (threads * 4);
+	if (target < PARALLEL_MIN_CHUNK)
+		target = PARALLEL_MIN_CHUNK;
+
+	counting = counting_config(doc);
+	count = split_chunks(doc, counting, target, &chunks);
+
+	if (count < 2) {
+		free(chunks);
+		rfcdown_config_free(counting);
+		return 0;
+	}
+
+	job.doc = doc;
+	job.chunks = chunks;
+	job.count = count;
+
+	/* counting the numbered headers before each chunk */
+	job.levels = hooks->header_levels ? hooks->header_levels(opaque) : 0;
+	if (job.levels > 0) {
+		job.config = counting;
+		run_chunk_job(&job, threads);
+
+		for (i = 0; i < count; ++i) {
+			in_chunk = chunks[i].headers;
+			chunks[i].headers = headers;
+			headers += in_chunk;
+		}
+	}
+	rfcdown_config_free(counting);
+
+	/* renderers may check whether output precedes a block, so every chunk
+	 * but the first is rendered after a placeholder byte */
+	job.levels = 0;
+	job.config = doc->config;
+	for (i = 0; i < count; ++i) {
+		chunks[i].state = hooks->chunk_new(opaque, chunks[i].headers);
+		chunks[i].seeded = (i > 0 || ob->size > 0);
+	}
+
+	run_chunk_job(&job, threads);
+
+	for (i = 0; i < count; ++i) {
+		struct chunk *c = &chunks[i];
+
+		/* nothing came before this chunk after all */
+		if (c->seeded && ob->size == 0) {
+			hooks->chunk_free(opaque, c->state);
+			c->state = hooks->chunk_new(opaque, c->headers);
+			c->out->size = 0;
+			c->seeded = 0;
+
+			doc->data.opaque = c->state;
+			render_chunk(c->out, doc, doc->text, c);
+			doc->data.opaque = opaque;
+		}
+
+		rfcdown_buffer_put(ob, c->out->data + c->seeded, c->out->size - c->seeded);
+		rfcdown_buffer_free(c->out);
+		hooks->chunk_free(opaque, c->state);
+	}
+
+	free(chunks);
+	return 1;
+}
+
+/*************************
+ * INCREMENTAL RENDERING *
+ *************************/
+
+/* block_out: the output of one top-level block, as last rendered */
+struct block_out {
+	size_t beg, end, look;	/* the block and the line after it in rfcdown_incremental.text */
+	unsigned int headers;	/* numbered headers in the block */
+	unsigned int before;	/* numbered headers before it, when rendered */
+	int seeded;
+	rfcdown_buffer *out;
+};
+
+struct rfcdown_incremental {
+	rfcdown_document *doc;
+	const rfcdown_chunk_hooks *hooks;
+
+	rfcdown_buffer *text;	/* doc->text of the last render */
+	rfcdown_buffer *defs;	/* its reference and footnote definitions */
+	rfcdown_buffer *next_defs;
+	struct block_out *blocks;
+	size_t count;
+
+	size_t rendered;	/* blocks rendered by the last render */
+};
+
+static void
+drop_blocks(rfcdown_incremental *inc)
+{
+	size_t i;
+
+	for (i = 0; i < inc->count; ++i)
+		rfcdown_buffer_free(inc->blocks[i].out);
+
+	free(inc->blocks);
+	inc->blocks = NULL;
+	inc->count = 0;
+}
+
+/* same_block • whether block `b` of the last render has the text of chunk `c` */
+static int
+same_block(const rfcdown_incremental *inc, const struct chunk *c, const struct block_out *b)
+{
+	return c->end - c->beg == b->end - b->beg &&
+		c->look - c->beg == b->look - b->beg &&
+		memcmp(inc->doc->text->data + c->beg, inc->text->data + b->beg, b->look - b->beg) == 0;
+}
+
+/* render_blocks • renders doc->text block by block, reusing the output of
+ * the blocks that kept their text, their place in the header numbering and
+ * their position at the start of the output or not */
+static void
+render_blocks(rfcdown_buffer *ob, rfcdown_incremental *inc)
+{
+	rfcdown_document *doc = inc->doc;
+	const rfcdown_chunk_hooks *hooks = inc->hooks;
+	void *opaque = doc->data.opaque;
+	rfcdown_config *counting;
+	struct chunk *chunks = NULL;
+	struct block_out *blocks;
+	struct chunk_job job;
+	rfcdown_buffer *swap;
+	size_t i, count, head = 0, tail = 0;
+	unsigned int headers = 0;
+	void **states, *end_state;
+	int levels;
+
+	/* any block may use a changed definition */
+	if (!rfcdown_buffer_eq(inc->defs, inc->next_defs->data, inc->next_defs->size))
+		drop_blocks(inc);
+	swap = inc->defs;
+	inc->defs = inc->next_defs;
+	inc->next_defs = swap;
+
+	counting = counting_config(doc);
+	count = split_chunks(doc, counting, 0, &chunks);
+	blocks = rfcdown_calloc(count, sizeof(struct block_out));
+
+	/* edits leave the blocks at both ends alone */
+	while (head < count && head < inc->count && same_block(inc, &chunks[head], &inc->blocks[head]))
+		head++;
+	while (tail < count - head && tail < inc->count - head &&
+		same_block(inc, &chunks[count - 1 - tail], &inc->blocks[inc->count - 1 - tail]))
+		tail++;
+
+	for (i = 0; i < count; ++i) {
+		struct block_out *old = NULL;
+
+		if (i < head)
+			old = &inc->blocks[i];
+		else if (i >= count - tail)
+			old = &inc->blocks[inc->count - (count - i)];
+
+		if (old) {
+			blocks[i] = *old;
+			old->out = NULL;
+		}
+		blocks[i].beg = chunks[i].beg;
+		blocks[i].end = chunks[i].end;
+		blocks[i].look = chunks[i].look;
+	}
+
+	/* counting the numbered headers of the changed blocks */
+	levels = hooks->header_levels ? hooks->header_levels(opaque) : 0;
+	if (levels > 0 && head + tail < count) {
+		job.doc = doc;
+		job.config = counting;
+		job.chunks = chunks + head;
+		job.count = count - head - tail;
+		job.levels = levels;
+		run_chunk_job(&job, 1);
+
+		for (i = head; i < count - tail; ++i)
+			blocks[i].headers = chunks[i].headers;
+	}
+	rfcdown_config_free(counting);
+
+	/* every state is taken before any is released, as in render_chunks */
+	states = rfcdown_malloc(count * sizeof(void *));
+	for (i = 0; i < count; ++i) {
+		states[i] = hooks->chunk_new(opaque, headers);
+		headers += blocks[i].headers;
+	}
+	end_state = hooks->chunk_new(opaque, headers);
+
+	inc->rendered = 0;
+	headers = 0;
+	for (i = 0; i < count; ++i) {
+		struct block_out *b = &blocks[i];
+		int seeded = (ob->size > 0);
+
+		if (!b->out || b->before != headers || b->seeded != seeded) {
+			if (!b->out)
+				b->out = rfcdown_buffer_new(64);
+			b->out->size = 0;
+			b->before = headers;
+			b->seeded = seeded;
+
+			/* renderers may check whether output precedes a block */
+			if (seeded)
+				rfcdown_buffer_putc(b->out, '\n');
+
+			doc->data.opaque = states[i];
+			render_chunk(b->out, doc, doc->text, &chunks[i]);
+			doc->data.opaque = opaque;
+			inc->rendered++;
+		}
+
+		rfcdown_buffer_put(ob, b->out->data + b->seeded, b->out->size - b->seeded);
+		hooks->chunk_free(opaque, states[i]);
+		headers += b->headers;
+	}
+	hooks->chunk_free(opaque, end_state);
+
+	/* the new blocks are the ones to compare with next time */
+	drop_blocks(inc);
+	inc->blocks = blocks;
+	inc->count = count;
+	inc->text->size = 0;
+	rfcdown_buffer_put(inc->text, doc->text->data, doc->text->size);
+
+	free(states);
+	free(chunks);
+}
+
+/**********************
+ * EXPORTED FUNCTIONS *
+ **********************/
+
+rfcdown_config *
+rfcdown_config_new(
+	const rfcdown_renderer *renderer,
+	rfcdown_extensions extensions,
+	size_t max_nesting)
+{
+	rfcdown_config *config = NULL;
+	uint8_t *active_char;
+
+	assert(max_nesting > 0 && renderer);
+
+	config = rfcdown_malloc(sizeof(rfcdown_config));
+	memcpy(&config->md, renderer, sizeof(rfcdown_renderer));
+
+	active_char = config->active_char;
+	memset(active_char, 0x0, 256);
+
+	if (extensions & RFCDOWN_EXT_UNDERLINE && renderer->underline) {
+		active_char['_'] = MD_CHAR_EMPHASIS;
+	}
+
+	if (renderer->emphasis || renderer->double_emphasis || renderer->triple_emphasis) {
+		active_char['*'] = MD_CHAR_EMPHASIS;
+		active_char['_'] = MD_CHAR_EMPHASIS;
+		if (extensions & RFCDOWN_EXT_STRIKETHROUGH)
+			active_char['~'] = MD_CHAR_EMPHASIS;
+		if (extensions & RFCDOWN_EXT_HIGHLIGHT)
+			active_char['='] = MD_CHAR_EMPHASIS;
+	}
+
+	if (renderer->codespan)
+		active_char['`'] = MD_CHAR_CODESPAN;
+
+	if (renderer->linebreak)
+		active_char['\n'] = MD_CHAR_LINEBREAK;
+
+	if (renderer->image || renderer->link || renderer->footnotes || renderer->footnote_ref)
+		active_char['['] = MD_CHAR_LINK;
+
+	active_char['<'] = MD_CHAR_LANGLE;
+	active_char['\\'] = MD_CHAR_ESCAPE;
+	active_char['&'] = MD_CHAR_ENTITY;
+
+	if (extensions & RFCDOWN_EXT_SUPERSCRIPT)
+		active_char['^'] = MD_CHAR_SUPERSCRIPT;
+
+	if (extensions & RFCDOWN_EXT_QUOTE)
+		active_char['"'] = MD_CHAR_QUOTE;
+
+	if (extensions & RFCDOWN_EXT_MATH)
+		active_char['$'] = MD_CHAR_MATH;
+
+	/* Extension data */
+	config->ext_flags = extensions;
+	config->max_nesting = max_nesting;
+
+	config->parser = &generic_parser;
+#ifdef RFCDOWN_SPEC_EXT
+	if (extensions == (rfcdown_extensions)(RFCDOWN_SPEC_EXT))
+		config->parser = &rfcdown_document__spec_parser;
+#endif
+
+	return config;
+}
+
+void
+rfcdown_config_free(rfcdown_config *config)
+{
+	free(config);
+}
+
+rfcdown_document *
+rfcdown_document_new_from_config(const rfcdown_config *config, void *opaque)
+{
+	rfcdown_document *doc = NULL;
+
+	assert(config);
+
+	doc = rfcdown_malloc(sizeof(rfcdown_document));
+
+	doc->config = config;
+	doc->own_config = NULL;
+	doc->md = &config->md;
+	doc->active_char = config->active_char;
+	doc->ext_flags = config->ext_flags;
+	doc->max_nesting = config->max_nesting;
+	doc->parser = config->parser;
+
+	doc->data.opaque = opaque;
+	doc->data.href_memo = NULL;
+
+	memset(doc->refs, 0x0, sizeof(doc->refs));
+	memset(&doc->footnotes_found, 0x0, sizeof(doc->footnotes_found));
+	memset(&doc->footnotes_used, 0x0, sizeof(doc->footnotes_used));
+
+	rfcdown_stack_init(&doc->work_bufs[BUFFER_BLOCK], 4);
+	rfcdown_stack_init(&doc->work_bufs[BUFFER_SPAN], 8);
+
+	doc->in_link_body = 0;
+	doc->shared_refs = 0;
+	doc->block_marks = NULL;
+	doc->block_limit = (size_t)-1;
+	doc->shared_text = 0;
+	doc->span = NULL;
+	doc->code_runs = NULL;
+	doc->table_cols = NULL;
+
+	doc->phase_callback = NULL;
+	doc->phase_opaque = NULL;
+
+	doc->text = NULL;
+	doc->spare_refs = NULL;
+	doc->spare_items = NULL;
+	rfcdown_stack_init(&doc->spare_footnotes, 4);
+	doc->retention = DEFAULT_RETENTION;
+
+	return doc;
+}
+
+rfcdown_document *
+rfcdown_document_new(
+	const rfcdown_renderer *renderer,
+	rfcdown_extensions extensions,
+	size_t max_nesting)
+{
+	rfcdown_config *config = rfcdown_config_new(renderer, extensions, max_nesting);
+	rfcdown_document *doc = rfcdown_document_new_from_config(config, renderer->opaque);
+
+	doc->own_config = config;
+	return doc;
+}
+
+void
+rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size)
+{
+	rfcdown_document_render_parallel(doc, ob, data, size, NULL, 1);
+}
+
+void
+rfcdown_document_render_parallel(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size,
+	const rfcdown_chunk_hooks *hooks, unsigned int threads)
+{
+	prepare_text(doc, data, size, NULL);
+
+	/* pre-grow the output buffer to minimize allocations */
+	rfcdown_buffer_grow(ob, doc->text->size + (doc->text->size >> 1));
+
+	/* second pass: actual rendering */
+	if (doc->md->doc_header)
+		doc->md->doc_header(ob, 0, &doc->data);
+
+	if (doc->text->size && !render_chunks(ob, doc, hooks, threads))
+		doc->parser->block(ob, doc, doc->text->data, doc->text->size);
+
+	finish_render(ob, doc);
+}
+
+rfcdown_incremental *
+rfcdown_incremental_new(rfcdown_document *doc, const rfcdown_chunk_hooks *hooks)
+{
+	rfcdown_incremental *inc = rfcdown_malloc(sizeof(rfcdown_incremental));
+
+	inc->doc = doc;
+	inc->hooks = hooks;
+	inc->text = rfcdown_buffer_new(64);
+	inc->defs = rfcdown_buffer_new(64);
+	inc->next_defs = rfcdown_buffer_new(64);
+	inc->blocks = NULL;
+	inc->count = 0;
+	inc->rendered = 0;
+
+	return inc;
+}
+
+void
+rfcdown_incremental_render(rfcdown_incremental *inc, rfcdown_buffer *ob, const uint8_t *data, size_t size)
+{
+	rfcdown_document *doc = inc->doc;
+
+	inc->next_defs->size = 0;
+	prepare_text(doc, data, size, inc->next_defs);
+
+	rfcdown_buffer_grow(ob, doc->text->size + (doc->text->size >> 1));
+
+	if (doc->md->doc_header)
+		doc->md->doc_header(ob, 0, &doc->data);
+
+	/* footnotes are numbered in order of use over the whole document */
+	if (inc->hooks && doc->footnotes_found.count == 0) {
+		if (doc->text->size)
+			render_blocks(ob, inc);
+	} else {
+		drop_blocks(inc);
+		if (doc->text->size)
+			doc->parser->block(ob, doc, doc->text->data, doc->text->size);
+		inc->rendered = 0;
+	}
+
+	finish_render(ob, doc);
+}
+
+void
+rfcdown_incremental_stats(const rfcdown_incremental *inc, size_t *blocks, size_t *rendered)
+{
+	if (blocks) *blocks = inc->count;
+	if (rendered) *rendered = inc->rendered;
+}
+
+void
+rfcdown_incremental_free(rfcdown_incremental *inc)
+{
+	drop_blocks(inc);
+	rfcdown_buffer_free(inc->text);
+	rfcdown_buffer_free(inc->defs);
+	rfcdown_buffer_free(inc->next_defs);
+	free(inc);
 }
 
 void
 rfcdown_document_render_inline(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size)
 {
 	size_t i = 0, mark;
-	rfcdown_buffer *text = rfcdown_buffer_new(64);
+	rfcdown_buffer *text;
+
+	if (!doc->text)
+		doc->text = rfcdown_buffer_new(64);
+	text = doc->text;
+	text->size = 0;
 
 	/* reset the references table */
 	memset(&doc->refs, 0x0, REF_TABLE_SIZE * sizeof(void *));
@@ -2947,26 +4385,50 @@ rfcdown_document_render_inline(rfcdown_document *doc, rfcdown_buffer *ob, const
 	/* second pass: actual rendering */
 	rfcdown_buffer_grow(ob, text->size + (text->size >> 1));
 
-	if (doc->md.doc_header)
-		doc->md.doc_header(ob, 1, &doc->data);
+	if (doc->md->doc_header)
+		doc->md->doc_header(ob, 1, &doc->data);
 
-	parse_inline(ob, doc, text->data, text->size);
+	doc->parser->span(ob, doc, text->data, text->size);
 
-	if (doc->md.doc_footer)
-		doc->md.doc_footer(ob, 1, &doc->data);
+	if (doc->md->doc_footer)
+		doc->md->doc_footer(ob, 1, &doc->data);
 
 	/* clean-up */
-	rfcdown_buffer_free(text);
+	trim_warm_state(doc, doc->retention);
 
 	assert(doc->work_bufs[BUFFER_SPAN].size == 0);
 	assert(doc->work_bufs[BUFFER_BLOCK].size == 0);
 }
 
+void
+rfcdown_document_set_phase_callback(rfcdown_document *doc, rfcdown_phase_callback callback, void *opaque)
+{
+	doc->phase_callback = callback;
+	doc->phase_opaque = opaque;
+}
+
+void
+rfcdown_document_set_retention(rfcdown_document *doc, size_t max_bytes)
+{
+	doc->retention = max_bytes;
+	trim_warm_state(doc, max_bytes);
+}
+
+void
+rfcdown_document_reset(rfcdown_document *doc)
+{
+	trim_warm_state(doc, 0);
+}
+
 void
 rfcdown_document_free(rfcdown_document *doc)
 {
 	size_t i;
 
+	/* an unallocated text weighs nothing, so trimming may leave it */
+	trim_warm_state(doc, 0);
+	rfcdown_buffer_free(doc->text);
+
 	for (i = 0; i < (size_t)doc->work_bufs[BUFFER_SPAN].asize; ++i)
 		rfcdown_buffer_free(doc->work_bufs[BUFFER_SPAN].item[i]);
 
@@ -2975,6 +4437,11 @@ rfcdown_document_free(rfcdown_document *doc)
 
 	rfcdown_stack_uninit(&doc->work_bufs[BUFFER_SPAN]);
 	rfcdown_stack_uninit(&doc->work_bufs[BUFFER_BLOCK]);
+	rfcdown_stack_uninit(&doc->spare_footnotes);
+
+	rfcdown_config_free(doc->own_config);
 
 	free(doc);
 }
+
+#endif /* RFCDOWN_SPEC_ONLY */
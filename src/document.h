@@ -85,11 +85,19 @@ typedef enum rfcdown_autolink_type {
  * TYPES *
  *********/
 
+struct rfcdown_config;
+typedef struct rfcdown_config rfcdown_config;
+
 struct rfcdown_document;
 typedef struct rfcdown_document rfcdown_document;
 
 struct rfcdown_renderer_data {
 	void *opaque;
+
+	/* scratch owned by the document while a reference-style link is being
+	 * rendered; renderers may keep their escaped form of the URL here, and
+	 * it stays valid for every use of the same reference (NULL otherwise) */
+	rfcdown_buffer *href_memo;
 };
 typedef struct rfcdown_renderer_data rfcdown_renderer_data;
 
@@ -143,11 +151,53 @@ struct rfcdown_renderer {
 };
 typedef struct rfcdown_renderer rfcdown_renderer;
 
+/* rfcdown_chunk_hooks - renderer support for rfcdown_document_render_parallel */
+struct rfcdown_chunk_hooks {
+	/* deepest header level the renderer numbers, 0 for none (may be NULL) */
+	int (*header_levels)(const void *opaque);
+
+	/* copy of the renderer state for a chunk following `headers` numbered headers */
+	void *(*chunk_new)(const void *opaque, unsigned int headers);
+
+	/* release a chunk state into the renderer state, called in document order */
+	void (*chunk_free)(void *opaque, void *state);
+};
+typedef struct rfcdown_chunk_hooks rfcdown_chunk_hooks;
+
+/* rfcdown_phase - the steps of a render, reported to a phase callback as they end */
+typedef enum rfcdown_phase {
+	RFCDOWN_PHASE_PREPARE,	/* first pass: references, footnotes and tab expansion; bytes of input */
+	RFCDOWN_PHASE_RENDER,	/* second pass: blocks and spans; bytes of expanded text */
+	RFCDOWN_PHASE_FOOTNOTES	/* footnotes, document footer and clean-up; bytes of output added */
+} rfcdown_phase;
+
+typedef void (*rfcdown_phase_callback)(void *opaque, rfcdown_phase phase, size_t bytes);
+
+/* rfcdown_incremental - successive renders of one changing document */
+struct rfcdown_incremental;
+typedef struct rfcdown_incremental rfcdown_incremental;
+
 
 /*************
  * FUNCTIONS *
  *************/
 
+/* rfcdown_config_new: allocate the immutable part of a document processor; it may be shared by documents on several threads */
+rfcdown_config *rfcdown_config_new(
+	const rfcdown_renderer *renderer,
+	rfcdown_extensions extensions,
+	size_t max_nesting
+) __attribute__ ((malloc));
+
+/* rfcdown_config_free: deallocate a configuration, once no document uses it */
+void rfcdown_config_free(rfcdown_config *config);
+
+/* rfcdown_document_new_from_config: allocate a document processor using a shared configuration, with its own renderer state (opaque) */
+rfcdown_document *rfcdown_document_new_from_config(
+	const rfcdown_config *config,
+	void *opaque
+) __attribute__ ((malloc));
+
 /* rfcdown_document_new: allocate a new document processor instance */
 rfcdown_document *rfcdown_document_new(
 	const rfcdown_renderer *renderer,
@@ -158,9 +208,34 @@ rfcdown_document *rfcdown_document_new(
 /* rfcdown_document_render: render regular Markdown using the document processor */
 void rfcdown_document_render(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size);
 
+/* rfcdown_document_render_parallel: like rfcdown_document_render, rendering runs of top-level blocks on up to `threads` threads; without hooks, or when the document has footnotes, it renders sequentially */
+void rfcdown_document_render_parallel(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size,
+	const rfcdown_chunk_hooks *hooks, unsigned int threads);
+
+/* rfcdown_incremental_new: keep the output of each top-level block rendered through doc, to reuse it when the block is unchanged; the renderer state must start alike for every render (hooks as for rfcdown_document_render_parallel) */
+rfcdown_incremental *rfcdown_incremental_new(rfcdown_document *doc, const rfcdown_chunk_hooks *hooks) __attribute__ ((malloc));
+
+/* rfcdown_incremental_render: like rfcdown_document_render, rendering only the blocks changed since the last call; everything is rendered again when the definitions change, the document has footnotes or there are no hooks */
+void rfcdown_incremental_render(rfcdown_incremental *inc, rfcdown_buffer *ob, const uint8_t *data, size_t size);
+
+/* rfcdown_incremental_stats: number of top-level blocks in the last render, and how many were rendered rather than reused (both 0 after a full render) */
+void rfcdown_incremental_stats(const rfcdown_incremental *inc, size_t *blocks, size_t *rendered);
+
+/* rfcdown_incremental_free: deallocate the kept output; the document is left alone */
+void rfcdown_incremental_free(rfcdown_incremental *inc);
+
 /* rfcdown_document_render_inline: render inline Markdown using the document processor */
 void rfcdown_document_render_inline(rfcdown_document *doc, rfcdown_buffer *ob, const uint8_t *data, size_t size);
 
+/* rfcdown_document_set_phase_callback: call back at the end of each phase of a render, e.g. to time it (NULL to stop) */
+void rfcdown_document_set_phase_callback(rfcdown_document *doc, rfcdown_phase_callback callback, void *opaque);
+
+/* rfcdown_document_set_retention: bound the buffers a document keeps warm between renders (1 MiB by default) */
+void rfcdown_document_set_retention(rfcdown_document *doc, size_t max_bytes);
+
+/* rfcdown_document_reset: release the buffers a document keeps warm between renders, e.g. when idle */
+void rfcdown_document_reset(rfcdown_document *doc);
+
 /* rfcdown_document_free: deallocate a document processor instance */
 void rfcdown_document_free(rfcdown_document *doc);
 
@@ -4,6 +4,10 @@
 #include <stdio.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
@@ -53,45 +57,103 @@ static const uint8_t HREF_SAFE[UINT8_MAX+1] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
+/*
+ * SSE2 classifier for the set above: a byte is unsafe when it is a
+ * control char or space, is >= '{', or is one of "&'<>[\\]^`.
+ */
+#if defined(__SSE2__)
+static size_t
+href_safe_span_sse2(const uint8_t *data, size_t i, size_t size)
+{
+	const __m128i lo = _mm_set1_epi8(0x20);
+	const __m128i hi = _mm_set1_epi8(0x7B);
+	const __m128i br = _mm_set1_epi8(0x5B);
+	const __m128i br_max = _mm_set1_epi8(3);
+
+	while (i + 16 <= size) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i bad, b;
+		int mask;
+
+		bad = _mm_cmpeq_epi8(_mm_min_epu8(v, lo), v);
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(_mm_max_epu8(v, hi), v));
+		b = _mm_sub_epi8(v, br);
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(_mm_min_epu8(b, br_max), b));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8('`')));
+
+		mask = _mm_movemask_epi8(bad);
+		if (mask)
+			return i + __builtin_ctz((unsigned int)mask);
+
+		i += 16;
+	}
+
+	return i;
+}
+#endif
+
+/* href_safe_span: returns the position of the first byte at or after i
+ * that needs escaping, or size if there is none */
+static size_t
+href_safe_span(const uint8_t *data, size_t i, size_t size)
+{
+#if defined(__SSE2__)
+	i = href_safe_span_sse2(data, i, size);
+#endif
+	while (i < size && HREF_SAFE[data[i]]) i++;
+	return i;
+}
+
 void
 rfcdown_escape_href(rfcdown_buffer *ob, const uint8_t *data, size_t size)
 {
 	static const char hex_chars[] = "0123456789ABCDEF";
-	size_t  i = 0, mark;
-	char hex_str[3];
+	size_t i, mark, esize;
+	uint8_t *out;
 
-	hex_str[0] = '%';
+	i = href_safe_span(data, 0, size);
 
-	while (i < size) {
-		mark = i;
-		while (i < size && HREF_SAFE[data[i]]) i++;
+	/* Optimization for cases where there's nothing to escape */
+	if (likely(i >= size)) {
+		rfcdown_buffer_put(ob, data, size);
+		return;
+	}
 
-		/* Optimization for cases where there's nothing to escape */
-		if (mark == 0 && i >= size) {
-			rfcdown_buffer_put(ob, data, size);
-			return;
-		}
+	/* compute the escaped size first, so the buffer only grows once */
+	esize = size;
+	for (mark = i; mark < size; mark = href_safe_span(data, mark + 1, size)) {
+		if (data[mark] == '&') esize += 4;
+		else if (data[mark] == '\'') esize += 5;
+		else esize += 2;
+	}
 
-		if (likely(i > mark)) {
-			rfcdown_buffer_put(ob, data + mark, i - mark);
-		}
+	rfcdown_buffer_grow(ob, ob->size + esize);
+	out = ob->data + ob->size;
+	mark = 0;
 
-		/* escaping */
-		if (i >= size)
-			break;
+	while (i < size) {
+		memcpy(out, data + mark, i - mark);
+		out += i - mark;
 
 		switch (data[i]) {
 		/* amp appears all the time in URLs, but needs
 		 * HTML-entity escaping to be inside an href */
 		case '&':
-			RFCDOWN_BUFPUTSL(ob, "&amp;");
+			memcpy(out, "&amp;", 5);
+			out += 5;
 			break;
 
 		/* the single quote is a valid URL character
 		 * according to the standard; it needs HTML
 		 * entity escaping too */
 		case '\'':
-			RFCDOWN_BUFPUTSL(ob, "&#x27;");
+			memcpy(out, "&#x27;", 6);
+			out += 6;
 			break;
 
 		/* the space can be escaped to %20 or a plus
@@ -100,19 +162,25 @@ rfcdown_escape_href(rfcdown_buffer *ob, const uint8_t *data, size_t size)
 		 * when building GET strings */
 #if 0
 		case ' ':
-			rfcdown_buffer_putc(ob, '+');
+			*out++ = '+';
 			break;
 #endif
 
 		/* every other character goes with a %XX escaping */
 		default:
-			hex_str[1] = hex_chars[(data[i] >> 4) & 0xF];
-			hex_str[2] = hex_chars[data[i] & 0xF];
-			rfcdown_buffer_put(ob, (uint8_t *)hex_str, 3);
+			out[0] = '%';
+			out[1] = hex_chars[(data[i] >> 4) & 0xF];
+			out[2] = hex_chars[data[i] & 0xF];
+			out += 3;
 		}
 
-		i++;
+		mark = i + 1;
+		i = href_safe_span(data, mark, size);
 	}
+
+	memcpy(out, data + mark, size - mark);
+	out += size - mark;
+	ob->size = out - ob->data;
 }
 
 
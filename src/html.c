@@ -3,8 +3,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 
+#include "chars.h"
 #include "escape.h"
 
 #define USE_XHTML(opt) (opt->flags & RFCDOWN_HTML_USE_XHTML)
@@ -36,7 +36,7 @@ rfcdown_html_is_tag(const uint8_t *data, size_t size, const char *tagname)
 	if (i == size)
 		return RFCDOWN_HTML_TAG_NONE;
 
-	if (isspace(data[i]) || data[i] == '>')
+	if (rfcdown_isspace(data[i]) || data[i] == '>')
 		return closed ? RFCDOWN_HTML_TAG_CLOSE : RFCDOWN_HTML_TAG_OPEN;
 
 	return RFCDOWN_HTML_TAG_NONE;
@@ -52,6 +52,32 @@ static void escape_href(rfcdown_buffer *ob, const uint8_t *source, size_t length
 	rfcdown_escape_href(ob, source, length);
 }
 
+/* close_quotes: SmartyPants quotes don't carry over from one block of text to the next */
+static void close_quotes(const rfcdown_renderer_data *data)
+{
+	rfcdown_html_renderer_state *state = data->opaque;
+	state->smartypants.in_squote = 0;
+	state->smartypants.in_dquote = 0;
+	state->smartypants.backtick_ob = NULL;
+}
+
+/* escape_link: escape_href through the document's memo, if it offers one */
+static void escape_link(rfcdown_buffer *ob, const rfcdown_buffer *link, const rfcdown_renderer_data *data)
+{
+	rfcdown_buffer *memo = data->href_memo;
+	size_t org = ob->size;
+
+	if (memo && memo->size) {
+		rfcdown_buffer_put(ob, memo->data, memo->size);
+		return;
+	}
+
+	escape_href(ob, link->data, link->size);
+
+	if (memo)
+		rfcdown_buffer_put(memo, ob->data + org, ob->size - org);
+}
+
 /********************
  * GENERIC RENDERER *
  ********************/
@@ -216,6 +242,7 @@ rndr_header(rfcdown_buffer *ob, const rfcdown_buffer *content, int level, const
 {
 	rfcdown_html_renderer_state *state = data->opaque;
 
+	close_quotes(data);
 	if (ob->size)
 		rfcdown_buffer_putc(ob, '\n');
 
@@ -236,7 +263,7 @@ rndr_link(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_buffe
 	RFCDOWN_BUFPUTSL(ob, "<a href=\"");
 
 	if (link && link->size)
-		escape_href(ob, link->data, link->size);
+		escape_link(ob, link, data);
 
 	if (title && title->size) {
 		RFCDOWN_BUFPUTSL(ob, "\" title=\"");
@@ -268,6 +295,7 @@ rndr_list(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_list_flags
 static void
 rndr_listitem(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_list_flags flags, const rfcdown_renderer_data *data)
 {
+	close_quotes(data);
 	RFCDOWN_BUFPUTSL(ob, "<li>");
 	if (content) {
 		size_t size = content->size;
@@ -285,12 +313,13 @@ rndr_paragraph(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_
 	rfcdown_html_renderer_state *state = data->opaque;
 	size_t i = 0;
 
+	close_quotes(data);
 	if (ob->size) rfcdown_buffer_putc(ob, '\n');
 
 	if (!content || !content->size)
 		return;
 
-	while (i < content->size && isspace(content->data[i])) i++;
+	while (i < content->size && rfcdown_isspace(content->data[i])) i++;
 
 	if (i == content->size)
 		return;
@@ -374,7 +403,7 @@ rndr_image(rfcdown_buffer *ob, const rfcdown_buffer *link, const rfcdown_buffer
 	if (!link || !link->size) return 0;
 
 	RFCDOWN_BUFPUTSL(ob, "<img src=\"");
-	escape_href(ob, link->data, link->size);
+	escape_link(ob, link, data);
 	RFCDOWN_BUFPUTSL(ob, "\" alt=\"");
 
 	if (alt && alt->size)
@@ -445,6 +474,7 @@ rndr_tablerow(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_r
 static void
 rndr_tablecell(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_table_flags flags, const rfcdown_renderer_data *data)
 {
+	close_quotes(data);
 	if (flags & RFCDOWN_TABLE_HEADER) {
 		RFCDOWN_BUFPUTSL(ob, "<th");
 	} else {
@@ -491,7 +521,15 @@ rndr_superscript(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdow
 static void
 rndr_normal_text(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
 {
-	if (content)
+	rfcdown_html_renderer_state *state = data->opaque;
+
+	if (!content)
+		return;
+
+	/* code spans and blocks never come through here, so they stay as they are */
+	if (state->flags & RFCDOWN_HTML_SMARTYPANTS)
+		rfcdown_html_smartypants_text(ob, &state->smartypants, content->data, content->size);
+	else
 		escape_html(ob, content->data, content->size);
 }
 
@@ -746,6 +784,46 @@ rfcdown_html_renderer_new(rfcdown_html_flags render_flags, int nesting_level)
 	return renderer;
 }
 
+static int
+html_header_levels(const void *opaque)
+{
+	const rfcdown_html_renderer_state *state = opaque;
+	return state->toc_data.nesting_level;
+}
+
+static void *
+html_chunk_new(const void *opaque, unsigned int headers)
+{
+	rfcdown_html_renderer_state *state = rfcdown_malloc(sizeof(rfcdown_html_renderer_state));
+
+	memcpy(state, opaque, sizeof(rfcdown_html_renderer_state));
+	state->toc_data.header_count += headers;
+
+	return state;
+}
+
+static void
+html_chunk_free(void *opaque, void *chunk)
+{
+	rfcdown_html_renderer_state *state = opaque;
+	rfcdown_html_renderer_state *chunk_state = chunk;
+
+	state->toc_data.header_count = chunk_state->toc_data.header_count;
+	free(chunk_state);
+}
+
+const rfcdown_chunk_hooks *
+rfcdown_html_chunk_hooks(void)
+{
+	static const rfcdown_chunk_hooks hooks = {
+		html_header_levels,
+		html_chunk_new,
+		html_chunk_free
+	};
+
+	return &hooks;
+}
+
 void
 rfcdown_html_renderer_free(rfcdown_renderer *renderer)
 {
@@ -19,7 +19,8 @@ typedef enum rfcdown_html_flags {
 	RFCDOWN_HTML_SKIP_HTML = (1 << 0),
 	RFCDOWN_HTML_ESCAPE = (1 << 1),
 	RFCDOWN_HTML_HARD_WRAP = (1 << 2),
-	RFCDOWN_HTML_USE_XHTML = (1 << 3)
+	RFCDOWN_HTML_USE_XHTML = (1 << 3),
+	RFCDOWN_HTML_SMARTYPANTS = (1 << 4)
 } rfcdown_html_flags;
 
 typedef enum rfcdown_html_tag {
@@ -33,6 +34,21 @@ typedef enum rfcdown_html_tag {
  * TYPES *
  *********/
 
+/* rfcdown_html_smartypants_state: quotes left open by rfcdown_html_smartypants_text */
+struct rfcdown_html_smartypants_state {
+	int in_squote;
+	int in_dquote;
+
+	/* a lone '`' ending the last text, which a '`' starting the next one
+	 * makes an opening quote: where it was written, or NULL */
+	const rfcdown_buffer *backtick_ob;
+	size_t backtick_end;
+};
+typedef struct rfcdown_html_smartypants_state rfcdown_html_smartypants_state;
+
+struct rfcdown_html_smartypants_stream;
+typedef struct rfcdown_html_smartypants_stream rfcdown_html_smartypants_stream;
+
 struct rfcdown_html_renderer_state {
 	void *opaque;
 
@@ -45,6 +61,9 @@ struct rfcdown_html_renderer_state {
 
 	rfcdown_html_flags flags;
 
+	/* open quotes of RFCDOWN_HTML_SMARTYPANTS, within one block */
+	rfcdown_html_smartypants_state smartypants;
+
 	/* extra callbacks */
 	void (*link_attributes)(rfcdown_buffer *ob, const rfcdown_buffer *url, const rfcdown_renderer_data *data);
 };
@@ -58,6 +77,21 @@ typedef struct rfcdown_html_renderer_state rfcdown_html_renderer_state;
 /* rfcdown_html_smartypants: process an HTML snippet using SmartyPants for smart punctuation */
 void rfcdown_html_smartypants(rfcdown_buffer *ob, const uint8_t *data, size_t size);
 
+/* rfcdown_html_smartypants_text: like rfcdown_html_smartypants, but for text that still needs HTML escaping, which it does on the way; quotes stay open across calls through state */
+void rfcdown_html_smartypants_text(rfcdown_buffer *ob, rfcdown_html_smartypants_state *state, const uint8_t *data, size_t size);
+
+/* rfcdown_html_smartypants_stream_new: allocates a SmartyPants processor for HTML that comes in pieces */
+rfcdown_html_smartypants_stream *rfcdown_html_smartypants_stream_new(void) __attribute__ ((malloc));
+
+/* rfcdown_html_smartypants_stream_feed: processes the next piece of HTML into ob, holding back what depends on the pieces to come (an unfinished tag or entity, a <pre> region not closed yet) */
+void rfcdown_html_smartypants_stream_feed(rfcdown_html_smartypants_stream *stream, rfcdown_buffer *ob, const uint8_t *data, size_t size);
+
+/* rfcdown_html_smartypants_stream_finish: processes what was held back into ob and ends the HTML; the output is the same as rfcdown_html_smartypants on the whole, and the stream is ready for more */
+void rfcdown_html_smartypants_stream_finish(rfcdown_html_smartypants_stream *stream, rfcdown_buffer *ob);
+
+/* rfcdown_html_smartypants_stream_free: deallocate a SmartyPants stream */
+void rfcdown_html_smartypants_stream_free(rfcdown_html_smartypants_stream *stream);
+
 /* rfcdown_html_is_tag: checks if data starts with a specific tag, returns the tag type or NONE */
 rfcdown_html_tag rfcdown_html_is_tag(const uint8_t *data, size_t size, const char *tagname);
 
@@ -73,6 +107,9 @@ rfcdown_renderer *rfcdown_html_toc_renderer_new(
 	int nesting_level
 ) __attribute__ ((malloc));
 
+/* rfcdown_html_chunk_hooks: hooks for rfcdown_document_render_parallel with a renderer from rfcdown_html_renderer_new (the TOC renderer needs the whole document) */
+const rfcdown_chunk_hooks *rfcdown_html_chunk_hooks(void);
+
 /* rfcdown_html_renderer_free: deallocate an HTML renderer */
 void rfcdown_html_renderer_free(rfcdown_renderer *renderer);
 
@@ -2,25 +2,29 @@
 
 #include <string.h>
 #include <stdlib.h>
-#include <stdio.h>
-#include <ctype.h>
 
-#ifdef _MSC_VER
-#define snprintf _snprintf
-#endif
+#include "chars.h"
+#include "html_smartypants_subs.h"
+
+#define SMARTYPANTS_LOOKAHEAD 16	/* most any callback but ltag reads past its character */
+#define SMARTYPANTS_TAG_LOOKAHEAD 10	/* most rfcdown_html_is_tag reads past a '<' */
 
 struct smartypants_data {
 	int in_squote;
 	int in_dquote;
 };
 
+struct rfcdown_html_smartypants_stream {
+	struct smartypants_data smrt;
+	rfcdown_buffer *held;	/* input that may depend on what comes next */
+	uint8_t previous_char;	/* the input byte before held */
+	size_t scanned;		/* how far into the tag held starts with it was searched */
+};
+
 static size_t smartypants_cb__ltag(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 static size_t smartypants_cb__dquote(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 static size_t smartypants_cb__amp(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__period(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__number(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__dash(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
-static size_t smartypants_cb__parens(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
+static size_t smartypants_cb__subs(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 static size_t smartypants_cb__squote(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 static size_t smartypants_cb__backtick(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
 static size_t smartypants_cb__escape(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size);
@@ -29,13 +33,13 @@ static size_t (*smartypants_cb_ptrs[])
 	(rfcdown_buffer *, struct smartypants_data *, uint8_t, const uint8_t *, size_t) =
 {
 	NULL,					/* 0 */
-	smartypants_cb__dash,	/* 1 */
-	smartypants_cb__parens,	/* 2 */
+	smartypants_cb__subs,	/* 1 */
+	smartypants_cb__subs,	/* 2 */
 	smartypants_cb__squote, /* 3 */
 	smartypants_cb__dquote, /* 4 */
 	smartypants_cb__amp,	/* 5 */
-	smartypants_cb__period,	/* 6 */
-	smartypants_cb__number,	/* 7 */
+	smartypants_cb__subs,	/* 6 */
+	smartypants_cb__subs,	/* 7 */
 	smartypants_cb__ltag,	/* 8 */
 	smartypants_cb__backtick, /* 9 */
 	smartypants_cb__escape, /* 10 */
@@ -60,48 +64,78 @@ static const uint8_t smartypants_cb_chars[UINT8_MAX+1] = {
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 };
 
+/* Same actions on text that is not HTML yet: 11 marks the characters
+ * rfcdown_escape_html would escape, there are no tags to skip and the
+ * Markdown parser has already taken care of backslash escapes. */
+static const uint8_t smartypants_text_chars[UINT8_MAX+1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 4, 0, 0, 0, 11, 3, 2, 0, 0, 0, 0, 1, 6, 0,
+	0, 7, 0, 7, 0, 0, 0, 0, 0, 0, 0, 0, 11, 0, 11, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
 static int
 word_boundary(uint8_t c)
 {
-	return c == 0 || isspace(c) || ispunct(c);
+	return c == 0 || rfcdown_ischar(c, RFCDOWN_CHAR_SPACE | RFCDOWN_CHAR_PUNCT);
 }
 
-/*
-	If 'text' begins with any kind of single quote (e.g. "'" or "&apos;" etc.),
-	returns the length of the sequence of characters that makes up the single-
-	quote.  Otherwise, returns zero.
-*/
-static size_t
-squote_len(const uint8_t *text, size_t size)
+/* smartypants_match: the longest pattern of the generated table that starts
+ * text and whose conditions hold, or NULL */
+static const struct smartypants_sub *
+smartypants_match(uint8_t previous_char, const uint8_t *text, size_t size)
 {
-	static char* single_quote_list[] = { "'", "&#39;", "&#x27;", "&apos;", NULL };
-	char** p;
+	size_t i;
+	int state = 1, last = 0;
 
-	for (p = single_quote_list; *p; ++p) {
-		size_t len = strlen(*p);
-		if (size >= len && memcmp(text, *p, len) == 0) {
-			return len;
-		}
+	for (i = 0; i < size; i++) {
+		state = smartypants_next[state][smartypants_class[text[i]]];
+		if (!state)
+			break;
+		if (smartypants_accept[state])
+			last = state;
 	}
 
-	return 0;
+	for (; last; last = smartypants_shorter[last]) {
+		const struct smartypants_sub *sub = &smartypants_subs[smartypants_accept[last] - 1];
+
+		if ((sub->flags & SMARTYPANTS_BEFORE) && !word_boundary(previous_char))
+			continue;
+		if ((sub->flags & SMARTYPANTS_AFTER) && sub->length < size && !word_boundary(text[sub->length]))
+			continue;
+		return sub;
+	}
+
+	return NULL;
 }
 
 /* Converts " or ' at very beginning or end of a word to left or right quote */
 static int
 smartypants_quotes(rfcdown_buffer *ob, uint8_t previous_char, uint8_t next_char, uint8_t quote, int *is_open)
 {
-	char ent[8];
-
 	if (*is_open && !word_boundary(next_char))
 		return 0;
 
 	if (!(*is_open) && !word_boundary(previous_char))
 		return 0;
 
-	snprintf(ent, sizeof(ent), "&%c%cquo;", (*is_open) ? 'r' : 'l', quote);
+	if (quote == 'd')
+		rfcdown_buffer_puts(ob, *is_open ? "&rdquo;" : "&ldquo;");
+	else
+		rfcdown_buffer_puts(ob, *is_open ? "&rsquo;" : "&lsquo;");
 	*is_open = !(*is_open);
-	rfcdown_buffer_puts(ob, ent);
 	return 1;
 }
 
@@ -116,38 +150,24 @@ smartypants_squote(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t pr
 				   const uint8_t *squote_text, size_t squote_size)
 {
 	if (size >= 2) {
-		uint8_t t1 = tolower(text[1]);
-		size_t next_squote_len = squote_len(text+1, size-1);
+		const struct smartypants_sub *sub = smartypants_match(0, text + 1, size - 1);
 
 		/* convert '' to &ldquo; or &rdquo; */
-		if (next_squote_len > 0) {
+		if (sub && sub->kind == SMARTYPANTS_SQUOTE) {
+			size_t next_squote_len = sub->length;
 			uint8_t next_char = (size > 1+next_squote_len) ? text[1+next_squote_len] : 0;
 			if (smartypants_quotes(ob, previous_char, next_char, 'd', &smrt->in_dquote))
 				return next_squote_len;
 		}
 
-		/* Tom's, isn't, I'm, I'd */
-		if ((t1 == 's' || t1 == 't' || t1 == 'm' || t1 == 'd') &&
-			(size == 3 || word_boundary(text[2]))) {
-			RFCDOWN_BUFPUTSL(ob, "&rsquo;");
-			return 0;
-		}
-
-		/* you're, you'll, you've */
-		if (size >= 3) {
-			uint8_t t2 = tolower(text[2]);
-
-			if (((t1 == 'r' && t2 == 'e') ||
-				(t1 == 'l' && t2 == 'l') ||
-				(t1 == 'v' && t2 == 'e')) &&
-				(size == 4 || word_boundary(text[3]))) {
-				RFCDOWN_BUFPUTSL(ob, "&rsquo;");
-				return 0;
-			}
+		/* Tom's, isn't, I'm, I'd, you're, you'll, you've */
+		if (sub && sub->kind == SMARTYPANTS_CONTRACTION) {
+			rfcdown_buffer_puts(ob, sub->replacement);
+			return sub->consume;
 		}
 	}
 
-	if (smartypants_quotes(ob, previous_char, size > 0 ? text[1] : 0, 's', &smrt->in_squote))
+	if (smartypants_quotes(ob, previous_char, size > 1 ? text[1] : 0, 's', &smrt->in_squote))
 		return 0;
 
 	rfcdown_buffer_put(ob, squote_text, squote_size);
@@ -161,46 +181,16 @@ smartypants_cb__squote(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_
 	return smartypants_squote(ob, smrt, previous_char, text, size, text, 1);
 }
 
-/* Converts (c), (r), (tm) */
+/* Converts the plain substitutions of the generated table: dashes,
+ * ellipses, (c), (r), (tm) and fractions */
 static size_t
-smartypants_cb__parens(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
+smartypants_cb__subs(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
-	if (size >= 3) {
-		uint8_t t1 = tolower(text[1]);
-		uint8_t t2 = tolower(text[2]);
+	const struct smartypants_sub *sub = smartypants_match(previous_char, text, size);
 
-		if (t1 == 'c' && t2 == ')') {
-			RFCDOWN_BUFPUTSL(ob, "&copy;");
-			return 2;
-		}
-
-		if (t1 == 'r' && t2 == ')') {
-			RFCDOWN_BUFPUTSL(ob, "&reg;");
-			return 2;
-		}
-
-		if (size >= 4 && t1 == 't' && t2 == 'm' && text[3] == ')') {
-			RFCDOWN_BUFPUTSL(ob, "&trade;");
-			return 3;
-		}
-	}
-
-	rfcdown_buffer_putc(ob, text[0]);
-	return 0;
-}
-
-/* Converts "--" to em-dash, etc. */
-static size_t
-smartypants_cb__dash(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
-{
-	if (size >= 3 && text[1] == '-' && text[2] == '-') {
-		RFCDOWN_BUFPUTSL(ob, "&mdash;");
-		return 2;
-	}
-
-	if (size >= 2 && text[1] == '-') {
-		RFCDOWN_BUFPUTSL(ob, "&ndash;");
-		return 1;
+	if (sub && sub->kind == SMARTYPANTS_SUB) {
+		rfcdown_buffer_puts(ob, sub->replacement);
+		return sub->consume - 1;
 	}
 
 	rfcdown_buffer_putc(ob, text[0]);
@@ -211,39 +201,27 @@ smartypants_cb__dash(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t
 static size_t
 smartypants_cb__amp(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
+	const struct smartypants_sub *sub = smartypants_match(previous_char, text, size);
 	size_t len;
-	if (size >= 6 && memcmp(text, "&quot;", 6) == 0) {
-		if (smartypants_quotes(ob, previous_char, size >= 7 ? text[6] : 0, 'd', &smrt->in_dquote))
-			return 5;
-	}
 
-	len = squote_len(text, size);
-	if (len > 0) {
-		return (len-1) + smartypants_squote(ob, smrt, previous_char, text+(len-1), size-(len-1), text, len);
-	}
-
-	if (size >= 4 && memcmp(text, "&#0;", 4) == 0)
-		return 3;
-
-	rfcdown_buffer_putc(ob, '&');
-	return 0;
-}
+	if (sub) {
+		switch (sub->kind) {
+		case SMARTYPANTS_DQUOTE:
+			if (smartypants_quotes(ob, previous_char, size > sub->length ? text[sub->length] : 0, 'd', &smrt->in_dquote))
+				return sub->length - 1;
+			break;
 
-/* Converts "..." to ellipsis */
-static size_t
-smartypants_cb__period(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
-{
-	if (size >= 3 && text[1] == '.' && text[2] == '.') {
-		RFCDOWN_BUFPUTSL(ob, "&hellip;");
-		return 2;
-	}
+		case SMARTYPANTS_SQUOTE:
+			len = sub->length;
+			return (len-1) + smartypants_squote(ob, smrt, previous_char, text+(len-1), size-(len-1), text, len);
 
-	if (size >= 5 && text[1] == ' ' && text[2] == '.' && text[3] == ' ' && text[4] == '.') {
-		RFCDOWN_BUFPUTSL(ob, "&hellip;");
-		return 4;
+		default:
+			rfcdown_buffer_puts(ob, sub->replacement);
+			return sub->consume - 1;
+		}
 	}
 
-	rfcdown_buffer_putc(ob, text[0]);
+	rfcdown_buffer_putc(ob, '&');
 	return 0;
 }
 
@@ -260,44 +238,11 @@ smartypants_cb__backtick(rfcdown_buffer *ob, struct smartypants_data *smrt, uint
 	return 0;
 }
 
-/* Converts 1/2, 1/4, 3/4 */
-static size_t
-smartypants_cb__number(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
-{
-	if (word_boundary(previous_char) && size >= 3) {
-		if (text[0] == '1' && text[1] == '/' && text[2] == '2') {
-			if (size == 3 || word_boundary(text[3])) {
-				RFCDOWN_BUFPUTSL(ob, "&frac12;");
-				return 2;
-			}
-		}
-
-		if (text[0] == '1' && text[1] == '/' && text[2] == '4') {
-			if (size == 3 || word_boundary(text[3]) ||
-				(size >= 5 && tolower(text[3]) == 't' && tolower(text[4]) == 'h')) {
-				RFCDOWN_BUFPUTSL(ob, "&frac14;");
-				return 2;
-			}
-		}
-
-		if (text[0] == '3' && text[1] == '/' && text[2] == '4') {
-			if (size == 3 || word_boundary(text[3]) ||
-				(size >= 6 && tolower(text[3]) == 't' && tolower(text[4]) == 'h' && tolower(text[5]) == 's')) {
-				RFCDOWN_BUFPUTSL(ob, "&frac34;");
-				return 2;
-			}
-		}
-	}
-
-	rfcdown_buffer_putc(ob, text[0]);
-	return 0;
-}
-
 /* Converts " to left or right double quote */
 static size_t
 smartypants_cb__dquote(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char, const uint8_t *text, size_t size)
 {
-	if (!smartypants_quotes(ob, previous_char, size > 0 ? text[1] : 0, 'd', &smrt->in_dquote))
+	if (!smartypants_quotes(ob, previous_char, size > 1 ? text[1] : 0, 'd', &smrt->in_dquote))
 		RFCDOWN_BUFPUTSL(ob, "&quot;");
 
 	return 0;
@@ -319,7 +264,7 @@ smartypants_cb__ltag(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t
 		while (i + 3 < size && memcmp(text + i, "-->",  3) != 0)
 			i++;
 		i += 3;
-		rfcdown_buffer_put(ob, text, i + 1);
+		rfcdown_buffer_put(ob, text, i < size ? i + 1 : size);
 		return i;
 	}
 
@@ -349,7 +294,7 @@ smartypants_cb__ltag(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t
 			i++;
 	}
 
-	rfcdown_buffer_put(ob, text, i + 1);
+	rfcdown_buffer_put(ob, text, i < size ? i + 1 : size);
 	return i;
 }
 
@@ -375,61 +320,233 @@ smartypants_cb__escape(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_
 	}
 }
 
-#if 0
-static struct {
-    uint8_t c0;
-    const uint8_t *pattern;
-    const uint8_t *entity;
-    int skip;
-} smartypants_subs[] = {
-    { '\'', "'s>",      "&rsquo;",  0 },
-    { '\'', "'t>",      "&rsquo;",  0 },
-    { '\'', "'re>",     "&rsquo;",  0 },
-    { '\'', "'ll>",     "&rsquo;",  0 },
-    { '\'', "'ve>",     "&rsquo;",  0 },
-    { '\'', "'m>",      "&rsquo;",  0 },
-    { '\'', "'d>",      "&rsquo;",  0 },
-    { '-',  "--",       "&mdash;",  1 },
-    { '-',  "<->",      "&ndash;",  0 },
-    { '.',  "...",      "&hellip;", 2 },
-    { '.',  ". . .",    "&hellip;", 4 },
-    { '(',  "(c)",      "&copy;",   2 },
-    { '(',  "(r)",      "&reg;",    2 },
-    { '(',  "(tm)",     "&trade;",  3 },
-    { '3',  "<3/4>",    "&frac34;", 2 },
-    { '3',  "<3/4ths>", "&frac34;", 2 },
-    { '1',  "<1/2>",    "&frac12;", 2 },
-    { '1',  "<1/4>",    "&frac14;", 2 },
-    { '1',  "<1/4th>",  "&frac14;", 2 },
-    { '&',  "&#0;",      0,       3 },
-};
-#endif
+/* smartypants_tag_complete: whether smartypants_cb__ltag can tell where the
+ * tag at the start of text ends without looking past size; the search starts
+ * over from *scanned, and leaves there where more input is needed */
+static int
+smartypants_tag_complete(const uint8_t *text, size_t size, size_t *scanned)
+{
+	static const char *skip_tags[] = {
+	  "pre", "code", "var", "samp", "kbd", "math", "script", "style"
+	};
+	static const size_t skip_tags_count = 8;
+
+	size_t tag, i = 0;
+
+	if (memcmp(text, "<!--", 4) == 0) {
+		i = *scanned > 4 ? *scanned : 4;
+		while (i + 3 < size && memcmp(text + i, "-->", 3) != 0)
+			i++;
+		*scanned = i;
+		return i + 3 < size;
+	}
+
+	while (i < size && text[i] != '>')
+		i++;
+	if (i == size)
+		return 0;
+
+	for (tag = 0; tag < skip_tags_count; ++tag) {
+		if (rfcdown_html_is_tag(text, size, skip_tags[tag]) == RFCDOWN_HTML_TAG_OPEN)
+			break;
+	}
+
+	if (tag == skip_tags_count)
+		return 1;
+
+	if (*scanned > i) i = *scanned;
+	for (;;) {
+		while (i < size && text[i] != '<')
+			i++;
+
+		if (size - i < SMARTYPANTS_TAG_LOOKAHEAD) {
+			*scanned = i;
+			return 0;
+		}
+
+		if (rfcdown_html_is_tag(text + i, size - i, skip_tags[tag]) == RFCDOWN_HTML_TAG_CLOSE)
+			break;
+
+		i++;
+	}
+
+	*scanned = i;
+	while (i < size && text[i] != '>')
+		i++;
+	return i < size;
+}
+
+/* smartypants_run: processes text into ob; unless final, stops at the first
+ * action that could turn out otherwise with more text. Returns the bytes used. */
+static size_t
+smartypants_run(rfcdown_buffer *ob, struct smartypants_data *smrt, uint8_t previous_char,
+				const uint8_t *text, size_t size, int final, size_t *scanned)
+{
+	size_t i;
+
+	for (i = 0; i < size; ++i) {
+		size_t org;
+		uint8_t action = 0;
+
+		org = i;
+		while (i < size && (action = smartypants_cb_chars[text[i]]) == 0)
+			i++;
+
+		if (i > org)
+			rfcdown_buffer_put(ob, text + org, i - org);
+
+		if (i >= size)
+			break;
+
+		if (!final) {
+			if (size - i < SMARTYPANTS_LOOKAHEAD)
+				return i;
+			if (action == 8) {
+				if (!smartypants_tag_complete(text + i, size - i, scanned))
+					return i;
+				*scanned = 0;
+			}
+		}
+
+		i += smartypants_cb_ptrs[(int)action]
+			(ob, smrt, i ? text[i - 1] : previous_char, text + i, size - i);
+	}
+
+	return size;
+}
 
 void
 rfcdown_html_smartypants(rfcdown_buffer *ob, const uint8_t *text, size_t size)
 {
-	size_t i;
 	struct smartypants_data smrt = {0, 0};
 
 	if (!text)
 		return;
 
 	rfcdown_buffer_grow(ob, size);
+	smartypants_run(ob, &smrt, 0, text, size, 1, NULL);
+}
 
-	for (i = 0; i < size; ++i) {
+rfcdown_html_smartypants_stream *
+rfcdown_html_smartypants_stream_new(void)
+{
+	rfcdown_html_smartypants_stream *stream = rfcdown_malloc(sizeof(rfcdown_html_smartypants_stream));
+
+	stream->smrt.in_squote = 0;
+	stream->smrt.in_dquote = 0;
+	stream->held = rfcdown_buffer_new(64);
+	stream->previous_char = 0;
+	stream->scanned = 0;
+
+	return stream;
+}
+
+void
+rfcdown_html_smartypants_stream_feed(rfcdown_html_smartypants_stream *stream, rfcdown_buffer *ob, const uint8_t *data, size_t size)
+{
+	const uint8_t *text = data;
+	size_t used;
+
+	/* Most of the time nothing is held, and data is used where it is */
+	if (stream->held->size) {
+		rfcdown_buffer_put(stream->held, data, size);
+		text = stream->held->data;
+		size = stream->held->size;
+	}
+
+	used = smartypants_run(ob, &stream->smrt, stream->previous_char, text, size, 0, &stream->scanned);
+	if (used == 0 && text == stream->held->data)
+		return;
+
+	if (used) stream->previous_char = text[used - 1];
+
+	if (text == stream->held->data)
+		rfcdown_buffer_slurp(stream->held, used);
+	else if (used < size)
+		rfcdown_buffer_put(stream->held, text + used, size - used);
+}
+
+void
+rfcdown_html_smartypants_stream_finish(rfcdown_html_smartypants_stream *stream, rfcdown_buffer *ob)
+{
+	smartypants_run(ob, &stream->smrt, stream->previous_char, stream->held->data, stream->held->size, 1, NULL);
+
+	/* Ready for another document */
+	stream->smrt.in_squote = 0;
+	stream->smrt.in_dquote = 0;
+	stream->held->size = 0;
+	stream->previous_char = 0;
+	stream->scanned = 0;
+}
+
+void
+rfcdown_html_smartypants_stream_free(rfcdown_html_smartypants_stream *stream)
+{
+	rfcdown_buffer_free(stream->held);
+	free(stream);
+}
+
+void
+rfcdown_html_smartypants_text(rfcdown_buffer *ob, rfcdown_html_smartypants_state *state, const uint8_t *text, size_t size)
+{
+	/* the text carries on from whatever was rendered before it */
+	uint8_t previous_char = ob->size ? ob->data[ob->size - 1] : 0;
+	struct smartypants_data smrt;
+	size_t i;
+
+	smrt.in_squote = state->in_squote;
+	smrt.in_dquote = state->in_dquote;
+	i = 0;
+
+	/* "``" split by a code span that didn't close: the parser hands the
+	 * backticks over one call at a time, with nothing in between */
+	if (size && text[0] == '`' && state->backtick_ob == ob &&
+		ob->size == state->backtick_end && ob->data[ob->size - 1] == '`') {
+		ob->size--;
+		previous_char = ob->size ? ob->data[ob->size - 1] : 0;
+		if (smartypants_quotes(ob, previous_char, size >= 2 ? text[1] : 0, 'd', &smrt.in_dquote))
+			i = 1;
+		else
+			previous_char = ob->data[ob->size++];
+	}
+	state->backtick_ob = NULL;
+
+	for (; i < size; ++i) {
 		size_t org;
 		uint8_t action = 0;
 
 		org = i;
-		while (i < size && (action = smartypants_cb_chars[text[i]]) == 0)
+		while (i < size && (action = smartypants_text_chars[text[i]]) == 0)
 			i++;
 
 		if (i > org)
 			rfcdown_buffer_put(ob, text + org, i - org);
 
-		if (i < size) {
+		if (i >= size)
+			break;
+
+		if (i) previous_char = text[i - 1];
+
+		if (action == 11) {
+			switch (text[i]) {
+			case '&': RFCDOWN_BUFPUTSL(ob, "&amp;"); break;
+			case '<': RFCDOWN_BUFPUTSL(ob, "&lt;"); break;
+			default: RFCDOWN_BUFPUTSL(ob, "&gt;"); break;
+			}
+		} else if (action == 3) {
+			/* a quote left alone still needs escaping */
+			i += smartypants_squote(ob, &smrt, previous_char, text + i, size - i, (const uint8_t *)"&#39;", 5);
+		} else {
 			i += smartypants_cb_ptrs[(int)action]
-				(ob, &smrt, i ? text[i - 1] : 0, text + i, size - i);
+				(ob, &smrt, previous_char, text + i, size - i);
 		}
 	}
+
+	state->in_squote = smrt.in_squote;
+	state->in_dquote = smrt.in_dquote;
+
+	if (size && text[size - 1] == '`' && ob->data[ob->size - 1] == '`') {
+		state->backtick_ob = ob;
+		state->backtick_end = ob->size;
+	}
 }
@@ -0,0 +1,1030 @@
+#include "tee.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Each callback of the tee calls the same callback of every renderer
+ * and appends one record to its output buffer: what each renderer
+ * wrote, one after the other, then the part of each renderer, stored
+ * in TEE_PART_SIZE bytes, and TEE_MARK. The content the document passes to a callback is made of
+ * such records, and each renderer is given its own parts of it. A
+ * renderer writes into a buffer holding the last byte of its output
+ * so far, which is all a renderer looks at.
+ *
+ * A renderer without a block callback skips the block, as it would on
+ * its own. One without a span callback, or turning a span down that
+ * another renders, gets the content or text of the span rather than
+ * its source, since the parse can't go both ways; the document only
+ * falls back to the source when every renderer turns the span down.
+ *
+ * The document drops the spaces before a line break and the '!' of an
+ * image from the end of its output buffer. TEE_MARK keeps it from
+ * doing so, and the tee drops them from each renderer's output
+ * instead.
+ */
+
+#define TEE_MARK 0
+
+struct tee_part {
+	size_t size;	/* bytes of the renderer's output in the record */
+	int has;	/* its output in the buffer is not empty up to there */
+	uint8_t last;	/* and ends with that byte */
+};
+
+struct tee_child {
+	const rfcdown_renderer *renderer;
+	rfcdown_renderer_data data;
+	rfcdown_buffer *out;
+};
+
+struct tee_state {
+	struct tee_child *children;
+	size_t count;
+
+	struct tee_part *parts;		/* of the record being written */
+	size_t start;			/* where it starts */
+
+	rfcdown_buffer *top;		/* output buffer of the render */
+	size_t floor;			/* where the render started in it */
+
+	rfcdown_buffer *view;		/* what a renderer writes into */
+	rfcdown_buffer *in;		/* a renderer's part of the content */
+};
+
+typedef void (*tee_block_cb)(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data);
+typedef int (*tee_span_cb)(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data);
+
+#define TEE_CB(renderer, type, offset) (*(const type *)((const char *)(renderer) + (offset)))
+
+/* a part is stored as its size, then one byte each for has and last */
+#define TEE_PART_SIZE (sizeof(size_t) + 2)
+
+#define RECORD_TAIL(tee) ((tee)->count * TEE_PART_SIZE + 1)
+
+/***********
+ * RECORDS *
+ ***********/
+
+/* tee_load • reads a part stored at src */
+static void
+tee_load(const uint8_t *src, struct tee_part *part)
+{
+	memcpy(&part->size, src, sizeof(size_t));
+	part->has = src[sizeof(size_t)];
+	part->last = src[sizeof(size_t) + 1];
+}
+
+/* tee_store • stores a part at dst */
+static void
+tee_store(uint8_t *dst, const struct tee_part *part)
+{
+	memcpy(dst, &part->size, sizeof(size_t));
+	dst[sizeof(size_t)] = part->has ? 1 : 0;
+	dst[sizeof(size_t) + 1] = part->last;
+}
+
+/* tee_record • reads the part of renderer i in the record ending at end,
+ * with the offset of its output; returns the size of the record */
+static size_t
+tee_record(const struct tee_state *tee, const uint8_t *end, size_t i, struct tee_part *part, size_t *offset)
+{
+	const uint8_t *parts = end - RECORD_TAIL(tee);
+	struct tee_part p;
+	size_t j, size = RECORD_TAIL(tee);
+
+	memset(part, 0x0, sizeof(struct tee_part));
+	*offset = 0;
+	for (j = 0; j < tee->count; ++j) {
+		tee_load(parts + j * TEE_PART_SIZE, &p);
+		if (j < i)
+			*offset += p.size;
+		else if (j == i)
+			*part = p;
+		size += p.size;
+	}
+
+	return size;
+}
+
+/* tee_write_part • updates the part of renderer i in the record ending at end */
+static void
+tee_write_part(const struct tee_state *tee, uint8_t *end, size_t i, const struct tee_part *part)
+{
+	tee_store(end - RECORD_TAIL(tee) + i * TEE_PART_SIZE, part);
+}
+
+/* tee_floor • where the records of a buffer start */
+static size_t
+tee_floor(const struct tee_state *tee, const rfcdown_buffer *ob)
+{
+	return ob == tee->top ? tee->floor : 0;
+}
+
+/* tee_first • the output of renderer i before the first record of ob */
+static void
+tee_first(const struct tee_state *tee, const rfcdown_buffer *ob, size_t i, struct tee_part *part)
+{
+	const rfcdown_buffer *out = tee->children[i].out;
+
+	part->size = 0;
+	part->has = (ob == tee->top && out->size > 0);
+	part->last = part->has ? out->data[out->size - 1] : 0;
+}
+
+/* tee_gather • appends the output of renderer i in the records of src to ob */
+static void
+tee_gather(const struct tee_state *tee, rfcdown_buffer *ob, const rfcdown_buffer *src, size_t i)
+{
+	size_t floor = tee_floor(tee, src), end, record, offset, size = 0, at;
+	struct tee_part part;
+
+	for (end = src->size; end > floor; end -= record) {
+		record = tee_record(tee, src->data + end, i, &part, &offset);
+		size += part.size;
+	}
+
+	if (!size)
+		return;
+
+	/* the records are read backwards, so the output is too */
+	rfcdown_buffer_grow(ob, ob->size + size);
+	at = ob->size + size;
+
+	for (end = src->size; end > floor; end -= record) {
+		record = tee_record(tee, src->data + end, i, &part, &offset);
+		at -= part.size;
+		memcpy(ob->data + at, src->data + end - record + offset, part.size);
+	}
+
+	ob->size += size;
+}
+
+/* tee_chop • drops up to max trailing bytes c from the output of renderer i
+ * in ob, as the document does from its own output */
+static void
+tee_chop(const struct tee_state *tee, rfcdown_buffer *ob, size_t i, uint8_t c, size_t max)
+{
+	size_t floor = tee_floor(tee, ob), end = ob->size, record = 0, offset, n = 0, cut;
+	size_t visited = 0;
+	struct tee_part part, tail;
+	uint8_t *data = NULL;
+
+	while (end > floor) {
+		record = tee_record(tee, ob->data + end, i, &part, &offset);
+		data = ob->data + end - record + offset;
+
+		for (n = part.size; n > 0 && max > 0 && data[n - 1] == c; n--)
+			max--;
+
+		if (n < part.size) {
+			cut = part.size - n;
+			memmove(data + n, data + part.size, ob->size - (size_t)(data + part.size - ob->data));
+			ob->size -= cut;
+			end -= cut;
+			record -= cut;
+
+			part.size = n;
+			tee_write_part(tee, ob->data + end, i, &part);
+		}
+
+		visited++;
+		if (n > 0 || max == 0)
+			break;
+
+		end -= record;
+	}
+
+	if (!visited)
+		return;
+
+	/* the records visited all end where the output now ends */
+	if (end > floor && n > 0) {
+		tail.has = 1;
+		tail.last = data[n - 1];
+	} else if (end > floor && max == 0 && end - record > floor) {
+		tee_record(tee, ob->data + end - record, i, &tail, &offset);
+	} else {
+		tee_first(tee, ob, i, &tail);
+	}
+
+	for (end = ob->size; visited > 0; visited--) {
+		record = tee_record(tee, ob->data + end, i, &part, &offset);
+		part.has = tail.has;
+		part.last = tail.last;
+		tee_write_part(tee, ob->data + end, i, &part);
+		end -= record;
+	}
+}
+
+/**********
+ * EVENTS *
+ **********/
+
+/* tee_begin • starts the record of an event in ob */
+static void
+tee_begin(struct tee_state *tee, rfcdown_buffer *ob, const rfcdown_renderer_data *data)
+{
+	size_t i;
+
+	tee->start = ob->size;
+	for (i = 0; i < tee->count; ++i) {
+		if (ob->size > tee_floor(tee, ob))
+			tee_load(ob->data + ob->size - RECORD_TAIL(tee) + i * TEE_PART_SIZE, &tee->parts[i]);
+		else
+			tee_first(tee, ob, i, &tee->parts[i]);
+		tee->parts[i].size = 0;
+	}
+
+	/* the memo holds the link as one renderer escapes it */
+	tee->children[0].data.href_memo = data->href_memo;
+}
+
+/* tee_view • the buffer renderer i writes the event into */
+static rfcdown_buffer *
+tee_view(struct tee_state *tee, size_t i)
+{
+	tee->view->size = 0;
+	if (tee->parts[i].has)
+		rfcdown_buffer_putc(tee->view, tee->parts[i].last);
+
+	return tee->view;
+}
+
+/* tee_content • the part of renderer i of the content of an event */
+static const rfcdown_buffer *
+tee_content(struct tee_state *tee, const rfcdown_buffer *content, size_t i)
+{
+	if (!content)
+		return NULL;
+
+	tee->in->size = 0;
+	tee_gather(tee, tee->in, content, i);
+	return tee->in;
+}
+
+/* tee_text • the text of a span, for renderer i, through its normal_text */
+static void
+tee_text(struct tee_state *tee, const rfcdown_buffer *text, size_t i)
+{
+	const rfcdown_renderer *r = tee->children[i].renderer;
+
+	if (!text)
+		return;
+
+	if (r->normal_text)
+		r->normal_text(tee->view, text, &tee->children[i].data);
+	else
+		rfcdown_buffer_put(tee->view, text->data, text->size);
+}
+
+/* tee_keep • moves what renderer i wrote into the record */
+static void
+tee_keep(struct tee_state *tee, rfcdown_buffer *ob, size_t i)
+{
+	struct tee_part *part = &tee->parts[i];
+	size_t seed = part->has ? 1 : 0;
+
+	if (tee->view->size <= seed)
+		return;
+
+	part->size = tee->view->size - seed;
+	rfcdown_buffer_put(ob, tee->view->data + seed, part->size);
+
+	part->has = 1;
+	part->last = tee->view->data[tee->view->size - 1];
+}
+
+/* tee_end • finishes the record, if any renderer wrote something */
+static void
+tee_end(struct tee_state *tee, rfcdown_buffer *ob)
+{
+	size_t i;
+
+	if (ob->size == tee->start)
+		return;
+
+	rfcdown_buffer_grow(ob, ob->size + RECORD_TAIL(tee));
+	for (i = 0; i < tee->count; ++i) {
+		tee_store(ob->data + ob->size, &tee->parts[i]);
+		ob->size += TEE_PART_SIZE;
+	}
+	rfcdown_buffer_putc(ob, TEE_MARK);
+}
+
+/* tee_span_end • finishes the record of a span, or takes it back when no
+ * renderer took the span */
+static int
+tee_span_end(struct tee_state *tee, rfcdown_buffer *ob, int taken)
+{
+	if (!taken) {
+		ob->size = tee->start;
+		return 0;
+	}
+
+	tee_end(tee, ob);
+	return 1;
+}
+
+/* tee_block • a block callback with content only */
+static void
+tee_block(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data, size_t offset)
+{
+	struct tee_state *tee = data->opaque;
+	tee_block_cb cb;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		cb = TEE_CB(tee->children[i].renderer, tee_block_cb, offset);
+		if (cb)
+			cb(tee_view(tee, i), tee_content(tee, content, i), &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+/* tee_span • a span callback with content only */
+static int
+tee_span(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data, size_t offset)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_buffer *in;
+	tee_span_cb cb;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		cb = TEE_CB(tee->children[i].renderer, tee_span_cb, offset);
+		in = tee_content(tee, content, i);
+
+		if (cb && cb(tee_view(tee, i), in, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			if (in)
+				rfcdown_buffer_put(tee->view, in->data, in->size);
+		}
+
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+/* block level callbacks */
+
+static void
+tee_blockcode(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_buffer *lang, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->blockcode)
+			r->blockcode(tee_view(tee, i), text, lang, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_blockquote(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, blockquote));
+}
+
+static void
+tee_header(rfcdown_buffer *ob, const rfcdown_buffer *content, int level, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->header)
+			r->header(tee_view(tee, i), tee_content(tee, content, i), level, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_hrule(rfcdown_buffer *ob, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->hrule)
+			r->hrule(tee_view(tee, i), &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_list(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_list_flags flags, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->list)
+			r->list(tee_view(tee, i), tee_content(tee, content, i), flags, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_listitem(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_list_flags flags, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->listitem)
+			r->listitem(tee_view(tee, i), tee_content(tee, content, i), flags, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_paragraph(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, paragraph));
+}
+
+static void
+tee_table(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, table));
+}
+
+static void
+tee_table_header(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, table_header));
+}
+
+static void
+tee_table_body(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, table_body));
+}
+
+static void
+tee_table_row(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, table_row));
+}
+
+static void
+tee_table_cell(rfcdown_buffer *ob, const rfcdown_buffer *content, rfcdown_table_flags flags, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->table_cell)
+			r->table_cell(tee_view(tee, i), tee_content(tee, content, i), flags, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_footnotes(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	tee_block(ob, content, data, offsetof(rfcdown_renderer, footnotes));
+}
+
+static void
+tee_footnote_def(rfcdown_buffer *ob, const rfcdown_buffer *content, unsigned int num, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->footnote_def)
+			r->footnote_def(tee_view(tee, i), tee_content(tee, content, i), num, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_blockhtml(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->blockhtml)
+			r->blockhtml(tee_view(tee, i), text, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+/* span level callbacks */
+
+static int
+tee_autolink(rfcdown_buffer *ob, const rfcdown_buffer *link, rfcdown_autolink_type type, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->autolink && r->autolink(tee_view(tee, i), link, type, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, link, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_codespan(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->codespan && r->codespan(tee_view(tee, i), text, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, text, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_double_emphasis(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, double_emphasis));
+}
+
+static int
+tee_emphasis(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, emphasis));
+}
+
+static int
+tee_underline(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, underline));
+}
+
+static int
+tee_highlight(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, highlight));
+}
+
+static int
+tee_quote(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, quote));
+}
+
+static int
+tee_image(rfcdown_buffer *ob, const rfcdown_buffer *link, const rfcdown_buffer *title, const rfcdown_buffer *alt, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	/* the '!' before the image goes, as the document would drop it */
+	for (i = 0; i < tee->count; ++i)
+		if (tee->children[i].renderer->image)
+			tee_chop(tee, ob, i, '!', 1);
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->image && r->image(tee_view(tee, i), link, title, alt, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, alt, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_linebreak(rfcdown_buffer *ob, const rfcdown_renderer_data *data)
+{
+	static const rfcdown_buffer newline = { (uint8_t *)"\n", 1, 0, 0, NULL, NULL, NULL };
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	/* the spaces before the break go, as the document would drop them */
+	for (i = 0; i < tee->count; ++i)
+		if (tee->children[i].renderer->linebreak)
+			tee_chop(tee, ob, i, ' ', (size_t)-1);
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->linebreak && r->linebreak(tee_view(tee, i), &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, &newline, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_link(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_buffer *link, const rfcdown_buffer *title, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	const rfcdown_buffer *in;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		in = tee_content(tee, content, i);
+
+		if (r->link && r->link(tee_view(tee, i), in, link, title, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			if (in)
+				rfcdown_buffer_put(tee->view, in->data, in->size);
+		}
+
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_triple_emphasis(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, triple_emphasis));
+}
+
+static int
+tee_strikethrough(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, strikethrough));
+}
+
+static int
+tee_superscript(rfcdown_buffer *ob, const rfcdown_buffer *content, const rfcdown_renderer_data *data)
+{
+	return tee_span(ob, content, data, offsetof(rfcdown_renderer, superscript));
+}
+
+static int
+tee_footnote_ref(rfcdown_buffer *ob, unsigned int num, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->footnote_ref && r->footnote_ref(tee_view(tee, i), num, &tee->children[i].data))
+			taken = 1;
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_math(rfcdown_buffer *ob, const rfcdown_buffer *text, int displaymode, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->math && r->math(tee_view(tee, i), text, displaymode, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, text, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+static int
+tee_raw_html(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	int taken = 0;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->raw_html && r->raw_html(tee_view(tee, i), text, &tee->children[i].data))
+			taken = 1;
+		else {
+			tee_view(tee, i);
+			tee_text(tee, text, i);
+		}
+		tee_keep(tee, ob, i);
+	}
+	return tee_span_end(tee, ob, taken);
+}
+
+/* low level callbacks */
+
+static void
+tee_entity(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->entity)
+			r->entity(tee_view(tee, i), text, &tee->children[i].data);
+		else
+			rfcdown_buffer_put(tee_view(tee, i), text->data, text->size);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_normal_text(rfcdown_buffer *ob, const rfcdown_buffer *text, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		tee_view(tee, i);
+		tee_text(tee, text, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+/* miscellaneous callbacks */
+
+static void
+tee_doc_header(rfcdown_buffer *ob, int inline_render, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee->top = ob;
+	tee->floor = ob->size;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->doc_header)
+			r->doc_header(tee_view(tee, i), inline_render, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+}
+
+static void
+tee_doc_footer(rfcdown_buffer *ob, int inline_render, const rfcdown_renderer_data *data)
+{
+	struct tee_state *tee = data->opaque;
+	const rfcdown_renderer *r;
+	size_t i;
+
+	tee_begin(tee, ob, data);
+	for (i = 0; i < tee->count; ++i) {
+		r = tee->children[i].renderer;
+		if (r->doc_footer)
+			r->doc_footer(tee_view(tee, i), inline_render, &tee->children[i].data);
+		else
+			tee_view(tee, i);
+		tee_keep(tee, ob, i);
+	}
+	tee_end(tee, ob);
+
+	/* the render is over: each renderer's output goes to its buffer */
+	for (i = 0; i < tee->count; ++i)
+		tee_gather(tee, tee->children[i].out, ob, i);
+
+	ob->size = tee->floor;
+	tee->top = NULL;
+}
+
+rfcdown_renderer *
+rfcdown_tee_renderer_new(const rfcdown_renderer *const *renderers, rfcdown_buffer *const *outputs, size_t n)
+{
+	static const rfcdown_renderer cb_default = {
+		NULL,
+
+		tee_blockcode,
+		tee_blockquote,
+		tee_header,
+		tee_hrule,
+		tee_list,
+		tee_listitem,
+		tee_paragraph,
+		tee_table,
+		tee_table_header,
+		tee_table_body,
+		tee_table_row,
+		tee_table_cell,
+		tee_footnotes,
+		tee_footnote_def,
+		tee_blockhtml,
+
+		tee_autolink,
+		tee_codespan,
+		tee_double_emphasis,
+		tee_emphasis,
+		tee_underline,
+		tee_highlight,
+		tee_quote,
+		tee_image,
+		tee_linebreak,
+		tee_link,
+		tee_triple_emphasis,
+		tee_strikethrough,
+		tee_superscript,
+		tee_footnote_ref,
+		tee_math,
+		tee_raw_html,
+
+		tee_entity,
+		tee_normal_text,
+
+		tee_doc_header,
+		tee_doc_footer
+	};
+
+	struct tee_state *state;
+	rfcdown_renderer *renderer;
+	size_t i;
+
+	/* Prepare the state pointer */
+	state = rfcdown_malloc(sizeof(struct tee_state));
+	memset(state, 0x0, sizeof(struct tee_state));
+
+	state->children = rfcdown_calloc(n ? n : 1, sizeof(struct tee_child));
+	state->parts = rfcdown_calloc(n ? n : 1, sizeof(struct tee_part));
+	state->count = n;
+	state->view = rfcdown_buffer_new(64);
+	state->in = rfcdown_buffer_new(64);
+
+	for (i = 0; i < n; ++i) {
+		state->children[i].renderer = renderers[i];
+		state->children[i].data.opaque = renderers[i]->opaque;
+		state->children[i].data.href_memo = NULL;
+		state->children[i].out = outputs[i];
+	}
+
+	/* Prepare the renderer */
+	renderer = rfcdown_malloc(sizeof(rfcdown_renderer));
+	memcpy(renderer, &cb_default, sizeof(rfcdown_renderer));
+
+	/* the document parses what at least one renderer renders; the
+	 * low level and document callbacks are always there, to keep the
+	 * output of every renderer in records */
+#define TEE_KEEP(member) do { \
+		for (i = 0; i < n && !renderers[i]->member; ++i) \
+			/* empty */; \
+		if (i == n) \
+			renderer->member = NULL; \
+	} while (0)
+
+	TEE_KEEP(blockcode);
+	TEE_KEEP(blockquote);
+	TEE_KEEP(header);
+	TEE_KEEP(hrule);
+	TEE_KEEP(list);
+	TEE_KEEP(listitem);
+	TEE_KEEP(paragraph);
+	TEE_KEEP(table);
+	TEE_KEEP(table_header);
+	TEE_KEEP(table_body);
+	TEE_KEEP(table_row);
+	TEE_KEEP(table_cell);
+	TEE_KEEP(footnotes);
+	TEE_KEEP(footnote_def);
+	TEE_KEEP(blockhtml);
+
+	TEE_KEEP(autolink);
+	TEE_KEEP(codespan);
+	TEE_KEEP(double_emphasis);
+	TEE_KEEP(emphasis);
+	TEE_KEEP(underline);
+	TEE_KEEP(highlight);
+	TEE_KEEP(quote);
+	TEE_KEEP(image);
+	TEE_KEEP(linebreak);
+	TEE_KEEP(link);
+	TEE_KEEP(triple_emphasis);
+	TEE_KEEP(strikethrough);
+	TEE_KEEP(superscript);
+	TEE_KEEP(footnote_ref);
+	TEE_KEEP(math);
+	TEE_KEEP(raw_html);
+#undef TEE_KEEP
+
+	renderer->opaque = state;
+	return renderer;
+}
+
+void
+rfcdown_tee_renderer_free(rfcdown_renderer *renderer)
+{
+	struct tee_state *state = renderer->opaque;
+
+	rfcdown_buffer_free(state->view);
+	rfcdown_buffer_free(state->in);
+	free(state->children);
+	free(state->parts);
+	free(state);
+	free(renderer);
+}
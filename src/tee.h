@@ -0,0 +1,34 @@
+/* tee.h - one parse rendered by several renderers */
+
+#ifndef RFCDOWN_TEE_H
+#define RFCDOWN_TEE_H
+
+#include "document.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/*************
+ * FUNCTIONS *
+ *************/
+
+/* rfcdown_tee_renderer_new: allocates a renderer passing each event on to n renderers; at the end of a render, the output of renderers[i] is appended to outputs[i] and the document's own output buffer is left as it was (renderers and buffers must outlive the tee) */
+/* A renderer's output matches a render of its own only as long as the renderers agree on the spans: one lacking a span callback another has, or turning such a span down, gets the text of the span (an autolink's link, an image's alt text, the code of math or raw HTML, nothing for a footnote reference) where on its own the source would be parsed again as text. The Table of Contents of a header holding an autolink, an image, raw HTML, math or a footnote reference thus differs from that of rfcdown_html_toc_renderer_new alone, as does the output of an HTML renderer skipping HTML. */
+rfcdown_renderer *rfcdown_tee_renderer_new(
+	const rfcdown_renderer *const *renderers,
+	rfcdown_buffer *const *outputs,
+	size_t n
+) __attribute__ ((malloc));
+
+/* rfcdown_tee_renderer_free: deallocate a tee renderer, leaving its renderers alone */
+void rfcdown_tee_renderer_free(rfcdown_renderer *renderer);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /** RFCDOWN_TEE_H **/
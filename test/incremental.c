@@ -0,0 +1,102 @@
+/* incremental.c - checks that incremental renders match whole renders */
+
+#include "html.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEF_UNIT 64
+#define DEF_MAX_NESTING 16
+
+#define EXTENSIONS (RFCDOWN_EXT_TABLES | RFCDOWN_EXT_FENCED_CODE | RFCDOWN_EXT_AUTOLINK)
+
+/* each case renders `before`, then `after` with the blocks kept from it */
+static const struct {
+	const char *name, *before, *after;
+} cases[] = {
+	{ "list item turned into a setext header",
+		"Para\n\n1. x\n1. x\n",
+		"Para\n\n1. x\n1. x\n---\n" },
+	{ "paragraph turned into a setext header",
+		"Para\n\nline\n\nend\n",
+		"Para\n\nline\n===\n\nend\n" },
+	{ "list made loose by the block after it",
+		"- a\n- b\n\ntext\n",
+		"- a\n- b\n\n- c\n" },
+	{ "block edited in the middle",
+		"# One\n\nfirst\n\nsecond\n\n# Two\n",
+		"# One\n\nfirst\n\nchanged\n\n# Two\n" },
+	{ "block inserted before a list",
+		"intro\n\n* a\n* b\n",
+		"intro\n\nmore\n\n* a\n* b\n" },
+	{ "definition changed under a kept block",
+		"[a][r]\n\n[r]: /one\n",
+		"[a][r]\n\n[r]: /two\n" },
+	{ "definitions split onto two lines",
+		"[a][x]\n\n[x]: /u \"t\"[x]: /u \"t\"\n\nb\n",
+		"[a][x]\n\n[x]: /u \"t\"\n[x]: /u \"t\"\n\nb\n" },
+	{ "definition title taken from the next line",
+		"[a][y]\n\n[y]: /v\n`\n\nc\n",
+		"[a][y]\n\n[y]: /v\n\" \n\nc\n" },
+	{ "blocks removed at the end",
+		"a\n\nb\n\nc\n",
+		"a\n" },
+	{ "empty document",
+		"a\n\nb\n",
+		"" }
+};
+
+static void
+render_whole(rfcdown_buffer *ob, const char *text)
+{
+	rfcdown_renderer *renderer = rfcdown_html_renderer_new(0, 0);
+	rfcdown_document *document = rfcdown_document_new(renderer, EXTENSIONS, DEF_MAX_NESTING);
+
+	rfcdown_document_render(document, ob, (const uint8_t *)text, strlen(text));
+
+	rfcdown_document_free(document);
+	rfcdown_html_renderer_free(renderer);
+}
+
+int
+main(void)
+{
+	rfcdown_buffer *ob = rfcdown_buffer_new(DEF_UNIT);
+	rfcdown_buffer *expected = rfcdown_buffer_new(DEF_UNIT);
+	size_t i, failed = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		rfcdown_renderer *renderer = rfcdown_html_renderer_new(0, 0);
+		rfcdown_document *document = rfcdown_document_new(renderer, EXTENSIONS, DEF_MAX_NESTING);
+		rfcdown_incremental *inc = rfcdown_incremental_new(document, rfcdown_html_chunk_hooks());
+
+		ob->size = 0;
+		rfcdown_incremental_render(inc, ob, (const uint8_t *)cases[i].before, strlen(cases[i].before));
+		ob->size = 0;
+		rfcdown_incremental_render(inc, ob, (const uint8_t *)cases[i].after, strlen(cases[i].after));
+
+		expected->size = 0;
+		render_whole(expected, cases[i].after);
+
+		if (!rfcdown_buffer_eq(ob, expected->data, expected->size)) {
+			printf("FAIL: %s\n--- expected\n%.*s--- got\n%.*s", cases[i].name,
+				(int)expected->size, (const char *)expected->data,
+				(int)ob->size, (const char *)ob->data);
+			failed++;
+		}
+
+		rfcdown_incremental_free(inc);
+		rfcdown_document_free(document);
+		rfcdown_html_renderer_free(renderer);
+	}
+
+	rfcdown_buffer_free(ob);
+	rfcdown_buffer_free(expected);
+
+	if (failed) {
+		printf("%lu of %lu incremental cases failed\n", (unsigned long)failed, (unsigned long)i);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+/* tee.c - checks that each renderer behind a tee renders as it would alone */
+
+#include "html.h"
+#include "tee.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define DEF_UNIT 64
+#define DEF_MAX_NESTING 16
+#define DEF_TOC_LEVEL 3
+
+#define EXTENSIONS (RFCDOWN_EXT_TABLES | RFCDOWN_EXT_FENCED_CODE | RFCDOWN_EXT_FOOTNOTES | \
+	RFCDOWN_EXT_AUTOLINK | RFCDOWN_EXT_STRIKETHROUGH | RFCDOWN_EXT_MATH)
+
+#define RENDERERS 3
+
+/* headers hold no span the TOC renderer lacks, see tee.h */
+static const struct {
+	const char *name, *text;
+} cases[] = {
+	{ "headers with spans",
+		"# One *two* **three**\n\n## With `code` and [a link](/x)\n\n### ~~Gone~~\n\n#### Too deep\n" },
+	{ "line break and image",
+		"# Top\n\nline  \nbreak and ![alt](/a.png \"t\") and !bang\n" },
+	{ "autolink, math and raw HTML outside headers",
+		"# Top\n\nSee <http://example.com>, www.example.com, $$x^2$$ and <b>bold</b>.\n" },
+	{ "lists, quotes, code and tables",
+		"# Top\n\n- a\n- b\n\n  c\n\n> quoted *text*\n\n```c\nint x;\n```\n\n| a | b |\n|---|---|\n| 1 | 2 |\n" },
+	{ "footnotes",
+		"# Top\n\nText[^1].\n\n[^1]: The *note*.\n" },
+	{ "no headers",
+		"just text\n" },
+	{ "empty document",
+		"" }
+};
+
+static rfcdown_renderer *
+new_renderer(size_t i)
+{
+	switch (i) {
+		case 0: return rfcdown_html_toc_renderer_new(DEF_TOC_LEVEL);
+		case 1: return rfcdown_html_renderer_new(0, DEF_TOC_LEVEL);
+		default: return rfcdown_html_renderer_new(RFCDOWN_HTML_HARD_WRAP | RFCDOWN_HTML_USE_XHTML, 0);
+	}
+}
+
+static void
+render_alone(rfcdown_buffer *ob, size_t i, const char *text)
+{
+	rfcdown_renderer *renderer = new_renderer(i);
+	rfcdown_document *document = rfcdown_document_new(renderer, EXTENSIONS, DEF_MAX_NESTING);
+
+	rfcdown_document_render(document, ob, (const uint8_t *)text, strlen(text));
+
+	rfcdown_document_free(document);
+	rfcdown_html_renderer_free(renderer);
+}
+
+int
+main(void)
+{
+	rfcdown_renderer *renderers[RENDERERS];
+	rfcdown_buffer *outputs[RENDERERS];
+	rfcdown_buffer *ob = rfcdown_buffer_new(DEF_UNIT);
+	rfcdown_buffer *expected = rfcdown_buffer_new(DEF_UNIT);
+	size_t i, j, failed = 0;
+
+	for (i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+		rfcdown_renderer *tee;
+		rfcdown_document *document;
+
+		for (j = 0; j < RENDERERS; ++j) {
+			renderers[j] = new_renderer(j);
+			outputs[j] = rfcdown_buffer_new(DEF_UNIT);
+		}
+
+		tee = rfcdown_tee_renderer_new((const rfcdown_renderer *const *)renderers, outputs, RENDERERS);
+		document = rfcdown_document_new(tee, EXTENSIONS, DEF_MAX_NESTING);
+
+		/* the document's own output buffer is left alone */
+		ob->size = 0;
+		rfcdown_buffer_puts(ob, "kept");
+		rfcdown_document_render(document, ob, (const uint8_t *)cases[i].text, strlen(cases[i].text));
+
+		if (!rfcdown_buffer_eqs(ob, "kept")) {
+			printf("FAIL: %s: output buffer changed\n", cases[i].name);
+			failed++;
+		}
+
+		for (j = 0; j < RENDERERS; ++j) {
+			expected->size = 0;
+			render_alone(expected, j, cases[i].text);
+
+			if (!rfcdown_buffer_eq(outputs[j], expected->data, expected->size)) {
+				printf("FAIL: %s: renderer %lu\n--- expected\n%.*s--- got\n%.*s", cases[i].name, (unsigned long)j,
+					(int)expected->size, (const char *)expected->data,
+					(int)outputs[j]->size, (const char *)outputs[j]->data);
+				failed++;
+			}
+		}
+
+		rfcdown_document_free(document);
+		rfcdown_tee_renderer_free(tee);
+
+		for (j = 0; j < RENDERERS; ++j) {
+			rfcdown_html_renderer_free(renderers[j]);
+			rfcdown_buffer_free(outputs[j]);
+		}
+	}
+
+	rfcdown_buffer_free(ob);
+	rfcdown_buffer_free(expected);
+
+	if (failed) {
+		printf("%lu tee checks failed\n", (unsigned long)failed);
+		return 1;
+	}
+
+	return 0;
+}